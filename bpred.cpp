@@ -0,0 +1,221 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.hpp"
+
+static const unsigned tage_hist_lengths[BPRED_TAGE_NUM_TABLES] = {4, 11, 28, 64};
+
+struct bpred {
+    bpred_kind_t kind;
+    // Packed 2-bit saturating counters, four per byte. Used by the bimodal
+    // and gshare predictors and as the TAGE base predictor
+    uint8_t *ctrs;
+    size_t log_entries;
+    // Global history, most recent branch in bit 0
+    uint64_t ghist;
+
+    // TAGE tagged tables, entries packed as ctr[2:0] u[4:3] tag[15:5]
+    uint16_t *tagged[BPRED_TAGE_NUM_TABLES];
+    uint64_t num_branches;
+
+    // Lookup state from the last bpred_predict(), consumed by bpred_update()
+    size_t base_idx;
+    size_t tagged_idx[BPRED_TAGE_NUM_TABLES];
+    uint16_t tagged_tag[BPRED_TAGE_NUM_TABLES];
+    int provider;  // -1 when the base predictor provided the prediction
+    bool provider_pred;
+    bool alt_pred;
+};
+
+#define TAGE_CTR(e) ((e) & 0x7)
+#define TAGE_U(e) (((e) >> 3) & 0x3)
+#define TAGE_TAG(e) ((e) >> 5)
+#define TAGE_PACK(ctr, u, tag) ((uint16_t)((ctr) | ((u) << 3) | ((tag) << 5)))
+
+/* read the 2-bit counter at idx */
+static inline unsigned ctr2_get(const uint8_t *ctrs, size_t idx) {
+    return (ctrs[idx >> 2] >> ((idx & 0x3) * 2)) & 0x3;
+}
+
+/* saturating increment/decrement of the 2-bit counter at idx */
+static inline void ctr2_update(uint8_t *ctrs, size_t idx, bool taken) {
+    unsigned shift = (idx & 0x3) * 2;
+    unsigned ctr = (ctrs[idx >> 2] >> shift) & 0x3;
+    if (taken && ctr < 3) ctr++;
+    if (!taken && ctr > 0) ctr--;
+    ctrs[idx >> 2] = (ctrs[idx >> 2] & ~(0x3 << shift)) | (ctr << shift);
+}
+
+/* xor-fold the low len bits of the history down to bits bits */
+static inline uint64_t fold_history(uint64_t hist, unsigned len, unsigned bits) {
+    if (len < 64) hist &= ((uint64_t)1 << len) - 1;
+    uint64_t folded = 0;
+    while (hist) {
+        folded ^= hist & (((uint64_t)1 << bits) - 1);
+        hist >>= bits;
+    }
+    return folded;
+}
+
+bpred_t *bpred_create(bpred_kind_t kind) {
+    if (kind == BPRED_TRACE) {
+        return NULL;
+    }
+    bpred_t *bp = (bpred_t *)calloc(1, sizeof(bpred_t));
+    if (bp == NULL) return NULL;
+    bp->kind = kind;
+    switch (kind) {
+        case BPRED_BIMODAL:
+            bp->log_entries = BPRED_BIMODAL_LOG_ENTRIES;
+            break;
+        case BPRED_GSHARE:
+            bp->log_entries = BPRED_GSHARE_LOG_ENTRIES;
+            break;
+        case BPRED_TAGE:
+            bp->log_entries = BPRED_TAGE_BASE_LOG_ENTRIES;
+            for (int t = 0; t < BPRED_TAGE_NUM_TABLES; t++) {
+                bp->tagged[t] = (uint16_t *)calloc(1 << BPRED_TAGE_LOG_ENTRIES, sizeof(uint16_t));
+                if (bp->tagged[t] == NULL) {
+                    bpred_destroy(bp);
+                    return NULL;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    // Initialize all counters to weakly not taken (0b01)
+    size_t num_bytes = ((size_t)1 << bp->log_entries) / 4;
+    bp->ctrs = (uint8_t *)malloc(num_bytes);
+    if (bp->ctrs == NULL) {
+        bpred_destroy(bp);
+        return NULL;
+    }
+    memset(bp->ctrs, 0x55, num_bytes);
+    return bp;
+}
+
+bool bpred_predict(bpred_t *bp, uint64_t pc) {
+    size_t mask = ((size_t)1 << bp->log_entries) - 1;
+    switch (bp->kind) {
+        case BPRED_BIMODAL:
+            bp->base_idx = (pc >> 2) & mask;
+            return ctr2_get(bp->ctrs, bp->base_idx) >= 2;
+        case BPRED_GSHARE:
+            bp->base_idx = ((pc >> 2) ^ (bp->ghist & ((1 << BPRED_GSHARE_HIST_BITS) - 1))) & mask;
+            return ctr2_get(bp->ctrs, bp->base_idx) >= 2;
+        case BPRED_TAGE:
+            break;
+        default:
+            return false;
+    }
+
+    // TAGE: the longest history table with a tag match provides the
+    // prediction, the next longest match (or the base) is the alternate
+    bp->base_idx = (pc >> 2) & mask;
+    bp->provider = -1;
+    bp->provider_pred = ctr2_get(bp->ctrs, bp->base_idx) >= 2;
+    bp->alt_pred = bp->provider_pred;
+    uint64_t pc_bits = pc >> 2;
+    for (int t = 0; t < BPRED_TAGE_NUM_TABLES; t++) {
+        unsigned len = tage_hist_lengths[t];
+        bp->tagged_idx[t] = (pc_bits ^ (pc_bits >> BPRED_TAGE_LOG_ENTRIES) ^
+                fold_history(bp->ghist, len, BPRED_TAGE_LOG_ENTRIES)) &
+                ((1 << BPRED_TAGE_LOG_ENTRIES) - 1);
+        bp->tagged_tag[t] = (pc_bits ^ fold_history(bp->ghist, len, BPRED_TAGE_TAG_BITS) ^
+                (fold_history(bp->ghist, len, BPRED_TAGE_TAG_BITS - 1) << 1)) &
+                ((1 << BPRED_TAGE_TAG_BITS) - 1);
+    }
+    for (int t = 0; t < BPRED_TAGE_NUM_TABLES; t++) {
+        uint16_t e = bp->tagged[t][bp->tagged_idx[t]];
+        if (TAGE_TAG(e) == bp->tagged_tag[t]) {
+            bp->alt_pred = bp->provider_pred;
+            bp->provider_pred = TAGE_CTR(e) >= 4;
+            bp->provider = t;
+        }
+    }
+    return bp->provider_pred;
+}
+
+void bpred_update(bpred_t *bp, uint64_t pc, bool taken) {
+    if (bp->kind != BPRED_TAGE) {
+        ctr2_update(bp->ctrs, bp->base_idx, taken);
+        bp->ghist = (bp->ghist << 1) | taken;
+        return;
+    }
+
+    if (bp->provider < 0) {
+        ctr2_update(bp->ctrs, bp->base_idx, taken);
+    } else {
+        uint16_t *e = &bp->tagged[bp->provider][bp->tagged_idx[bp->provider]];
+        unsigned ctr = TAGE_CTR(*e);
+        unsigned u = TAGE_U(*e);
+        if (taken && ctr < 7) ctr++;
+        if (!taken && ctr > 0) ctr--;
+        // The entry is useful when it disagrees with the alternate and is right
+        if (bp->provider_pred != bp->alt_pred) {
+            if (bp->provider_pred == taken && u < 3) u++;
+            if (bp->provider_pred != taken && u > 0) u--;
+        }
+        *e = TAGE_PACK(ctr, u, TAGE_TAG(*e));
+    }
+
+    // On a mispredict, allocate an entry in a longer history table
+    if (bp->provider_pred != taken) {
+        bool allocated = false;
+        for (int t = bp->provider + 1; t < BPRED_TAGE_NUM_TABLES; t++) {
+            uint16_t *e = &bp->tagged[t][bp->tagged_idx[t]];
+            if (TAGE_U(*e) == 0) {
+                *e = TAGE_PACK(taken ? 4 : 3, 0, bp->tagged_tag[t]);
+                allocated = true;
+                break;
+            }
+        }
+        // Nothing free, so age the candidates so that one frees up eventually
+        if (!allocated) {
+            for (int t = bp->provider + 1; t < BPRED_TAGE_NUM_TABLES; t++) {
+                uint16_t *e = &bp->tagged[t][bp->tagged_idx[t]];
+                *e = TAGE_PACK(TAGE_CTR(*e), TAGE_U(*e) - 1, TAGE_TAG(*e));
+            }
+        }
+    }
+
+    bp->num_branches++;
+    if (bp->num_branches % BPRED_TAGE_U_RESET_PERIOD == 0) {
+        for (int t = 0; t < BPRED_TAGE_NUM_TABLES; t++) {
+            for (size_t i = 0; i < (1 << BPRED_TAGE_LOG_ENTRIES); i++) {
+                uint16_t e = bp->tagged[t][i];
+                bp->tagged[t][i] = TAGE_PACK(TAGE_CTR(e), TAGE_U(e) >> 1, TAGE_TAG(e));
+            }
+        }
+    }
+
+    bp->ghist = (bp->ghist << 1) | taken;
+}
+
+void bpred_destroy(bpred_t *bp) {
+    if (bp == NULL) return;
+    for (int t = 0; t < BPRED_TAGE_NUM_TABLES; t++) {
+        free(bp->tagged[t]);
+    }
+    free(bp->ctrs);
+    free(bp);
+}
+
+static const char *bpred_names[] = {"trace", "bimodal", "gshare", "tage"};
+
+int bpred_parse_kind(const char *name, bpred_kind_t *kind_out) {
+    for (size_t i = 0; i < sizeof bpred_names / sizeof bpred_names[0]; i++) {
+        if (strcmp(name, bpred_names[i]) == 0) {
+            *kind_out = (bpred_kind_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *bpred_kind_name(bpred_kind_t kind) {
+    return bpred_names[kind];
+}
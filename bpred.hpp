@@ -0,0 +1,52 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Branch direction predictor models. The trace only gives us a mispredict bit
+// computed by whatever predictor the trace was captured with; these let the
+// driver recompute that bit with a predictor of our choosing.
+
+typedef enum {
+    BPRED_TRACE = 0,  // Use the trace's mispredict bit as-is
+    BPRED_BIMODAL,
+    BPRED_GSHARE,
+    BPRED_TAGE,
+} bpred_kind_t;
+
+// Bimodal: PC-indexed table of 2-bit counters (4 KiB)
+#define BPRED_BIMODAL_LOG_ENTRIES 14
+
+// Gshare: PC xor global history indexed table of 2-bit counters (4 KiB)
+#define BPRED_GSHARE_LOG_ENTRIES 14
+#define BPRED_GSHARE_HIST_BITS 14
+
+// TAGE-like: a bimodal base predictor plus tagged tables indexed with
+// geometrically increasing global history lengths. Each tagged entry is packed
+// into 16 bits, so the whole predictor is about 9 KiB.
+#define BPRED_TAGE_BASE_LOG_ENTRIES 12
+#define BPRED_TAGE_NUM_TABLES 4
+#define BPRED_TAGE_LOG_ENTRIES 10
+#define BPRED_TAGE_TAG_BITS 11
+// Clear the useful bits this often (in branches) so stale entries age out
+#define BPRED_TAGE_U_RESET_PERIOD (1 << 18)
+
+typedef struct bpred bpred_t;
+
+/* Returns NULL for BPRED_TRACE or on allocation failure */
+bpred_t *bpred_create(bpred_kind_t kind);
+/* Returns true if the branch at pc is predicted taken */
+bool bpred_predict(bpred_t *bp, uint64_t pc);
+/* Train the predictor on the actual direction of the branch at pc. Must be
+ * called once after each bpred_predict() for the same branch */
+void bpred_update(bpred_t *bp, uint64_t pc, bool taken);
+void bpred_destroy(bpred_t *bp);
+
+/* Parse a predictor name (trace, bimodal, gshare, tage).
+ * Returns 0 on success, -1 on unknown name */
+int bpred_parse_kind(const char *name, bpred_kind_t *kind_out);
+const char *bpred_kind_name(bpred_kind_t kind);
+
+#endif
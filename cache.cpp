@@ -0,0 +1,114 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unordered_set>
+#include <vector>
+
+#include "cache.hpp"
+
+struct cache {
+    size_t num_sets;
+    size_t assoc;
+    // Line address + 1 held by each way, 0 when the way is invalid
+    uint64_t *tags;
+    // When each way was last used, the smallest is the LRU way
+    uint64_t *last_use;
+    uint64_t clock;
+};
+
+cache_t *cache_create(size_t size_bytes, size_t assoc) {
+    cache_t *cache = (cache_t *)calloc(1, sizeof(cache_t));
+    if (cache == NULL) return NULL;
+    cache->assoc = assoc;
+    cache->num_sets = size_bytes / (assoc * CACHE_LINE_SIZE);
+    if (cache->num_sets == 0) cache->num_sets = 1;
+    cache->tags = (uint64_t *)calloc(cache->num_sets * assoc, sizeof(uint64_t));
+    cache->last_use = (uint64_t *)calloc(cache->num_sets * assoc, sizeof(uint64_t));
+    if (cache->tags == NULL || cache->last_use == NULL) {
+        cache_destroy(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+bool cache_probe(const cache_t *cache, uint64_t addr) {
+    uint64_t line = addr / CACHE_LINE_SIZE;
+    const uint64_t *set = &cache->tags[(line % cache->num_sets) * cache->assoc];
+    for (size_t w = 0; w < cache->assoc; w++) {
+        if (set[w] == line + 1) return true;
+    }
+    return false;
+}
+
+bool cache_access(cache_t *cache, uint64_t addr) {
+    uint64_t line = addr / CACHE_LINE_SIZE;
+    size_t base = (line % cache->num_sets) * cache->assoc;
+    size_t victim = base;
+    cache->clock++;
+    for (size_t i = base; i < base + cache->assoc; i++) {
+        if (cache->tags[i] == line + 1) {
+            cache->last_use[i] = cache->clock;
+            return true;
+        }
+        if (cache->last_use[i] < cache->last_use[victim]) victim = i;
+    }
+    cache->tags[victim] = line + 1;
+    cache->last_use[victim] = cache->clock;
+    return false;
+}
+
+void cache_destroy(cache_t *cache) {
+    if (cache == NULL) return;
+    free(cache->tags);
+    free(cache->last_use);
+    free(cache);
+}
+
+struct shared_l2 {
+    cache_t *cache;
+    size_t num_cores;
+    // Per core, the addresses read this quantum in order
+    std::vector<uint64_t> *logs;
+    // Per core, the lines missed on this quantum
+    std::unordered_set<uint64_t> *missed;
+};
+
+shared_l2_t *shared_l2_create(size_t size_bytes, size_t assoc, size_t num_cores) {
+    shared_l2_t *l2 = new shared_l2_t();
+    l2->cache = cache_create(size_bytes, assoc);
+    if (l2->cache == NULL) {
+        delete l2;
+        return NULL;
+    }
+    l2->num_cores = num_cores;
+    l2->logs = new std::vector<uint64_t>[num_cores];
+    l2->missed = new std::unordered_set<uint64_t>[num_cores];
+    return l2;
+}
+
+bool shared_l2_read(shared_l2_t *l2, size_t core_id, uint64_t addr) {
+    uint64_t line = addr / CACHE_LINE_SIZE;
+    l2->logs[core_id].push_back(addr);
+    if (cache_probe(l2->cache, addr) || l2->missed[core_id].count(line)) {
+        return true;
+    }
+    l2->missed[core_id].insert(line);
+    return false;
+}
+
+void shared_l2_sync(shared_l2_t *l2) {
+    for (size_t c = 0; c < l2->num_cores; c++) {
+        for (uint64_t addr : l2->logs[c]) {
+            cache_access(l2->cache, addr);
+        }
+        l2->logs[c].clear();
+        l2->missed[c].clear();
+    }
+}
+
+void shared_l2_destroy(shared_l2_t *l2) {
+    if (l2 == NULL) return;
+    cache_destroy(l2->cache);
+    delete[] l2->logs;
+    delete[] l2->missed;
+    delete l2;
+}
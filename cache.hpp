@@ -0,0 +1,44 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Functional set-associative cache with LRU replacement. It only tracks which
+// lines are present; the trace's miss bits already model the L1s, so this is
+// used for the levels behind them.
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct cache cache_t;
+
+/* size_bytes must be a multiple of assoc * CACHE_LINE_SIZE.
+ * Returns NULL on allocation failure */
+cache_t *cache_create(size_t size_bytes, size_t assoc);
+/* true if the line holding addr is present, without touching the LRU state */
+bool cache_probe(const cache_t *cache, uint64_t addr);
+/* Look up the line holding addr, making it the most recently used and filling
+ * it on a miss. Returns true on a hit */
+bool cache_access(cache_t *cache, uint64_t addr);
+void cache_destroy(cache_t *cache);
+
+// L2 shared by the cores of a multi-core run, each simulated on its own host
+// thread. During a quantum every core only reads the shared state and logs
+// its accesses; shared_l2_sync() applies the logs in core order at the
+// barrier between quanta, so results do not depend on thread timing. A line a
+// core missed on counts as present for that core for the rest of the quantum.
+
+typedef struct shared_l2 shared_l2_t;
+
+/* Returns NULL on allocation failure */
+shared_l2_t *shared_l2_create(size_t size_bytes, size_t assoc, size_t num_cores);
+/* Read from core core_id. Returns true on a hit. Safe to call concurrently
+ * from different cores, but not concurrently with shared_l2_sync() */
+bool shared_l2_read(shared_l2_t *l2, size_t core_id, uint64_t addr);
+/* Apply the accesses logged since the last sync. Must be called with every
+ * core stopped */
+void shared_l2_sync(shared_l2_t *l2);
+void shared_l2_destroy(shared_l2_t *l2);
+
+#endif
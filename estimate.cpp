@@ -0,0 +1,238 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estimate.hpp"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* cycles from firing an instruction until its result is ready */
+static uint64_t exec_latency(const inst_t *inst) {
+    switch (inst->opcode) {
+        case OPCODE_MUL:
+            return MUL_STAGES;
+        case OPCODE_LOAD:
+            return L1_HIT_TIME + (inst->dcache_miss ? L1_MISS_PENALTY : 0);
+        case OPCODE_STORE:
+            return 1;
+        default:
+            return ALU_STAGES;
+    }
+}
+
+// FU reservations are kept in calendars indexed by cycle modulo this size, so
+// that a younger instruction can fill a cycle an older one left idle
+#define CALENDAR_SIZE 4096
+
+typedef struct {
+    uint64_t cycle;  // Which cycle the slot currently describes
+    uint32_t used;   // FUs busy in that cycle
+} calendar_slot_t;
+
+/* number of FUs already busy in the cycle */
+static uint32_t calendar_used(const calendar_slot_t *cal, uint64_t cycle) {
+    const calendar_slot_t *slot = &cal[cycle % CALENDAR_SIZE];
+    return slot->cycle == cycle ? slot->used : 0;
+}
+
+static void calendar_reserve(calendar_slot_t *cal, uint64_t cycle) {
+    calendar_slot_t *slot = &cal[cycle % CALENDAR_SIZE];
+    if (slot->cycle != cycle) {
+        slot->cycle = cycle;
+        slot->used = 0;
+    }
+    slot->used++;
+}
+
+/* earliest cycle at or after ready in which one of num_fus FUs can be held
+ * for occupancy consecutive cycles, which is then reserved */
+static uint64_t calendar_fire(calendar_slot_t *cal, size_t num_fus,
+                              uint64_t ready, uint64_t occupancy) {
+    uint64_t fire = ready;
+    for (uint64_t c = 0; c < occupancy; ) {
+        if (calendar_used(cal, fire + c) >= num_fus) {
+            fire += c + 1;
+            c = 0;
+        } else {
+            c++;
+        }
+    }
+    for (uint64_t c = 0; c < occupancy; c++) {
+        calendar_reserve(cal, fire + c);
+    }
+    return fire;
+}
+
+// The interval model follows each instruction through the same stage timing
+// as procsim_do_cycle(): fetch at cycle f, dispatch no earlier than f + 1, fire
+// no earlier than dispatch + 1 and once its producers complete, and retire in
+// order the cycle after completing. Fetch stops after a mispredicted branch
+// until it retires, stalls L1_MISS_PENALTY cycles on an I-cache miss and
+// waits for room in a bounded DispQ.
+// Dispatch waits on the ROB, SchedQ and preg windows, approximating each as
+// "the instruction that many entries earlier must have left", and instructions
+// claim the first FU cycles left free by the instructions before them.
+int estimate_ipc(const inst_t *insts, const inst_deps_t *deps, size_t n_insts,
+                 const procsim_conf_t *sim_conf, estimate_t *est_out) {
+    memset(est_out, 0, sizeof *est_out);
+    if (n_insts == 0) return 0;
+
+    inst_deps_t *own_deps = NULL;
+    if (deps == NULL) {
+        own_deps = trace_deps_compute(insts, n_insts);
+        deps = own_deps;
+    }
+
+    size_t num_rob = sim_conf->num_rob_entries;
+    size_t num_sched = sim_conf->num_schedq_entries_per_fu *
+        (sim_conf->num_alu_fus + sim_conf->num_mul_fus + sim_conf->num_lsu_fus);
+    // Up to NUM_REGS pregs end up holding committed architectural state
+    size_t num_writers = sim_conf->num_pregs > NUM_REGS ? sim_conf->num_pregs - NUM_REGS : 1;
+
+    uint64_t *complete = (uint64_t *)malloc(n_insts * sizeof(uint64_t));
+    uint64_t *path = (uint64_t *)malloc(n_insts * sizeof(uint64_t));
+    uint64_t *rob_retire = (uint64_t *)calloc(num_rob, sizeof(uint64_t));
+    uint64_t *sched_complete = (uint64_t *)calloc(num_sched, sizeof(uint64_t));
+    uint64_t *writer_retire = (uint64_t *)calloc(num_writers, sizeof(uint64_t));
+    // Dispatch cycles of the last num_dispq instructions, for a bounded DispQ
+    size_t num_dispq = sim_conf->num_dispq_entries;
+    uint64_t *dispq_leave = (uint64_t *)calloc(num_dispq ? num_dispq : 1, sizeof(uint64_t));
+    calendar_slot_t *calendars = (calendar_slot_t *)calloc(3 * CALENDAR_SIZE, sizeof(calendar_slot_t));
+    if (!deps || !complete || !path || !rob_retire || !sched_complete ||
+            !writer_retire || !dispq_leave || !calendars) {
+        free(own_deps);
+        free(complete);
+        free(path);
+        free(rob_retire);
+        free(sched_complete);
+        free(writer_retire);
+        free(dispq_leave);
+        free(calendars);
+        return -1;
+    }
+    calendar_slot_t *alu_cal = calendars;
+    calendar_slot_t *mul_cal = alu_cal + CALENDAR_SIZE;
+    calendar_slot_t *lsu_cal = mul_cal + CALENDAR_SIZE;
+    // Mark every slot as not describing any cycle yet
+    for (size_t c = 0; c < 3 * CALENDAR_SIZE; c++) {
+        calendars[c].cycle = UINT64_MAX;
+    }
+
+    uint64_t fetch_cycle = 0;
+    size_t fetched_this_cycle = 0;
+    uint64_t last_dispatch = 0;
+    uint64_t last_retire = 0;
+    uint64_t last_store_complete = 0;
+    uint64_t last_mem_complete = 0;
+    size_t writers = 0;
+
+    uint64_t critical_path = 0;
+    uint64_t alu_ops = 0, mul_ops = 0, lsu_busy = 0;
+
+    for (size_t i = 0; i < n_insts; i++) {
+        const inst_t *inst = &insts[i];
+        uint64_t lat = exec_latency(inst);
+
+        // Dataflow critical path, ignoring every structural limit
+        uint64_t path_start = 0;
+        if (deps[i].src1_producer != DEPS_NONE) path_start = MAX(path_start, path[deps[i].src1_producer]);
+        if (deps[i].src2_producer != DEPS_NONE) path_start = MAX(path_start, path[deps[i].src2_producer]);
+        path[i] = path_start + lat;
+        critical_path = MAX(critical_path, path[i]);
+
+        // Fetch
+        if (fetched_this_cycle == sim_conf->fetch_width) {
+            fetch_cycle++;
+            fetched_this_cycle = 0;
+        }
+        if (inst->icache_miss) {
+            fetch_cycle += L1_MISS_PENALTY;
+            fetched_this_cycle = 0;
+        }
+        // A full DispQ holds fetch until the instruction num_dispq earlier leaves
+        if (num_dispq && i >= num_dispq && dispq_leave[i % num_dispq] > fetch_cycle) {
+            fetch_cycle = dispq_leave[i % num_dispq];
+            fetched_this_cycle = 0;
+        }
+        fetched_this_cycle++;
+
+        // Dispatch
+        uint64_t dispatch = MAX(fetch_cycle + 1, last_dispatch);
+        dispatch = MAX(dispatch, rob_retire[i % num_rob]);
+        dispatch = MAX(dispatch, sched_complete[i % num_sched]);
+        if (inst->dest >= 0) {
+            dispatch = MAX(dispatch, writer_retire[writers % num_writers]);
+        }
+        last_dispatch = dispatch;
+        if (num_dispq) {
+            dispq_leave[i % num_dispq] = dispatch;
+        }
+
+        // Fire
+        uint64_t fire = dispatch + 1;
+        if (deps[i].src1_producer != DEPS_NONE) fire = MAX(fire, complete[deps[i].src1_producer]);
+        if (deps[i].src2_producer != DEPS_NONE) fire = MAX(fire, complete[deps[i].src2_producer]);
+        switch (inst->opcode) {
+            case OPCODE_MUL:
+                fire = calendar_fire(mul_cal, sim_conf->num_mul_fus, fire, 1);
+                mul_ops++;
+                break;
+            case OPCODE_LOAD:
+            case OPCODE_STORE:
+                fire = MAX(fire, inst->opcode == OPCODE_LOAD ? last_store_complete : last_mem_complete);
+                // The LSUs are not pipelined
+                fire = calendar_fire(lsu_cal, sim_conf->num_lsu_fus, fire, lat);
+                lsu_busy += lat;
+                break;
+            default:
+                fire = calendar_fire(alu_cal, sim_conf->num_alu_fus, fire, 1);
+                alu_ops++;
+                break;
+        }
+
+        complete[i] = fire + lat;
+        sched_complete[i % num_sched] = complete[i];
+        if (inst->opcode == OPCODE_STORE) {
+            last_store_complete = complete[i];
+        }
+        if (inst->opcode == OPCODE_LOAD || inst->opcode == OPCODE_STORE) {
+            last_mem_complete = MAX(last_mem_complete, complete[i]);
+        }
+
+        // Retire
+        uint64_t retire = MAX(complete[i] + 1, last_retire);
+        last_retire = retire;
+        rob_retire[i % num_rob] = retire;
+        if (inst->dest >= 0) {
+            writer_retire[writers++ % num_writers] = retire;
+        }
+
+        // Fetch resumes the cycle after a mispredicted branch retires
+        if (inst->mispredict) {
+            fetch_cycle = retire + 1;
+            fetched_this_cycle = 0;
+        }
+    }
+
+    uint64_t bound = (n_insts + sim_conf->fetch_width - 1) / sim_conf->fetch_width;
+    bound = MAX(bound, critical_path);
+    bound = MAX(bound, (alu_ops + sim_conf->num_alu_fus - 1) / sim_conf->num_alu_fus);
+    bound = MAX(bound, (mul_ops + sim_conf->num_mul_fus - 1) / sim_conf->num_mul_fus);
+    bound = MAX(bound, (lsu_busy + sim_conf->num_lsu_fus - 1) / sim_conf->num_lsu_fus);
+
+    est_out->critical_path = critical_path;
+    est_out->upper_bound_cycles = bound;
+    est_out->upper_bound_ipc = (double)n_insts / bound;
+    est_out->interval_cycles = last_retire + 1;
+    est_out->interval_ipc = (double)n_insts / est_out->interval_cycles;
+
+    free(own_deps);
+    free(complete);
+    free(path);
+    free(rob_retire);
+    free(sched_complete);
+    free(writer_retire);
+    free(dispq_leave);
+    free(calendars);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "procsim.hpp"
+#include "trace_deps.hpp"
+
+// Analytical IPC estimates computed in a single pass over the trace, for
+// screening configurations much faster than procsim_do_cycle() can
+
+typedef struct {
+    // Longest producer-to-consumer latency chain through the trace
+    uint64_t critical_path;
+    // Bound from fetch width, FU throughput and the critical path alone,
+    // ignoring all front-end events and window limits
+    uint64_t upper_bound_cycles;
+    double upper_bound_ipc;
+    // Interval-analysis estimate, which adds the ROB, SchedQ and preg
+    // windows, memory ordering and mispredict and I-cache miss penalties
+    uint64_t interval_cycles;
+    double interval_ipc;
+} estimate_t;
+
+/* Estimate the IPC of the trace on the given configuration. deps may be NULL,
+ * in which case the annotations are computed here.
+ * Returns 0 on success, -1 on allocation failure */
+int estimate_ipc(const inst_t *insts, const inst_deps_t *deps, size_t n_insts,
+                 const procsim_conf_t *sim_conf, estimate_t *est_out);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define FNV1A64_INIT 0xcbf29ce484222325ULL
+
+/* 64-bit FNV-1a hash of len bytes at data, continuing from hash */
+static inline uint64_t fnv1a64(const void *data, size_t len, uint64_t hash) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hotspot.hpp"
+
+#define HOTSPOT_INITIAL_SLOTS 1024
+
+struct hotspot_table {
+    // Entries in insertion order, so growing the table never moves them
+    hotspot_entry_t *entries;
+    size_t num_entries;
+    size_t cap_entries;
+    // Index + 1 of the entry hashed to each slot, 0 when the slot is empty.
+    // Kept at most half full
+    uint32_t *slots;
+    size_t slot_mask;
+};
+
+static inline size_t hotspot_hash(uint64_t pc) {
+    return (size_t)((pc * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+hotspot_table_t *hotspot_create(void) {
+    hotspot_table_t *table = (hotspot_table_t *)calloc(1, sizeof(hotspot_table_t));
+    if (table == NULL) return NULL;
+    table->cap_entries = HOTSPOT_INITIAL_SLOTS / 2;
+    table->entries = (hotspot_entry_t *)malloc(table->cap_entries * sizeof(hotspot_entry_t));
+    table->slots = (uint32_t *)calloc(HOTSPOT_INITIAL_SLOTS, sizeof(uint32_t));
+    table->slot_mask = HOTSPOT_INITIAL_SLOTS - 1;
+    if (table->entries == NULL || table->slots == NULL) {
+        hotspot_destroy(table);
+        return NULL;
+    }
+    return table;
+}
+
+/* double the slots and entries, rehashing every entry */
+static int hotspot_grow(hotspot_table_t *table) {
+    size_t num_slots = 2 * (table->slot_mask + 1);
+    uint32_t *slots = (uint32_t *)calloc(num_slots, sizeof(uint32_t));
+    hotspot_entry_t *entries = (hotspot_entry_t *)realloc(
+        table->entries, num_slots / 2 * sizeof(hotspot_entry_t));
+    if (slots == NULL || entries == NULL) {
+        free(slots);
+        if (entries != NULL) table->entries = entries;
+        return -1;
+    }
+    for (size_t i = 0; i < table->num_entries; i++) {
+        size_t s = hotspot_hash(entries[i].pc) & (num_slots - 1);
+        while (slots[s] != 0) s = (s + 1) & (num_slots - 1);
+        slots[s] = i + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_mask = num_slots - 1;
+    table->entries = entries;
+    table->cap_entries = num_slots / 2;
+    return 0;
+}
+
+hotspot_entry_t *hotspot_lookup(hotspot_table_t *table, uint64_t pc, opcode_t opcode) {
+    size_t s = hotspot_hash(pc) & table->slot_mask;
+    while (table->slots[s] != 0) {
+        hotspot_entry_t *entry = &table->entries[table->slots[s] - 1];
+        if (entry->pc == pc) return entry;
+        s = (s + 1) & table->slot_mask;
+    }
+    if (table->num_entries == table->cap_entries) {
+        if (hotspot_grow(table) != 0) return NULL;
+        return hotspot_lookup(table, pc, opcode);
+    }
+    hotspot_entry_t *entry = &table->entries[table->num_entries++];
+    memset(entry, 0, sizeof *entry);
+    entry->pc = pc;
+    entry->opcode = opcode;
+    table->slots[s] = table->num_entries;
+    return entry;
+}
+
+void hotspot_clear(hotspot_table_t *table) {
+    memset(table->slots, 0, (table->slot_mask + 1) * sizeof(uint32_t));
+    table->num_entries = 0;
+}
+
+int hotspot_merge(hotspot_table_t *dst, const hotspot_table_t *src) {
+    for (size_t i = 0; i < src->num_entries; i++) {
+        const hotspot_entry_t *from = &src->entries[i];
+        hotspot_entry_t *to = hotspot_lookup(dst, from->pc, from->opcode);
+        if (to == NULL) return -1;
+        to->retired += from->retired;
+        for (int k = 0; k < NUM_HOTSPOT_KINDS; k++) {
+            to->cycles[k] += from->cycles[k];
+        }
+    }
+    return 0;
+}
+
+static uint64_t hotspot_total(const hotspot_entry_t *entry) {
+    uint64_t total = 0;
+    for (int k = 0; k < NUM_HOTSPOT_KINDS; k++) total += entry->cycles[k];
+    return total;
+}
+
+static int compare_hotspot_total(const void *a, const void *b) {
+    const hotspot_entry_t *ea = (const hotspot_entry_t *)a;
+    const hotspot_entry_t *eb = (const hotspot_entry_t *)b;
+    uint64_t ta = hotspot_total(ea), tb = hotspot_total(eb);
+    if (ta != tb) return ta > tb ? -1 : 1;
+    if (ea->pc != eb->pc) return ea->pc < eb->pc ? -1 : 1;
+    return 0;
+}
+
+size_t hotspot_top(const hotspot_table_t *table, size_t n, hotspot_entry_t *out) {
+    hotspot_entry_t *sorted = (hotspot_entry_t *)malloc(
+        (table->num_entries ? table->num_entries : 1) * sizeof(hotspot_entry_t));
+    if (sorted == NULL) return 0;
+    memcpy(sorted, table->entries, table->num_entries * sizeof(hotspot_entry_t));
+    qsort(sorted, table->num_entries, sizeof(hotspot_entry_t), compare_hotspot_total);
+    if (n > table->num_entries) n = table->num_entries;
+    memcpy(out, sorted, n * sizeof(hotspot_entry_t));
+    free(sorted);
+    return n;
+}
+
+void hotspot_destroy(hotspot_table_t *table) {
+    if (table == NULL) return;
+    free(table->entries);
+    free(table->slots);
+    free(table);
+}
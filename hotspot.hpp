@@ -0,0 +1,40 @@
+#ifndef HOTSPOT_H
+#define HOTSPOT_H
+
+#include "procsim.hpp"
+
+// Per-PC profile of where stall cycles go. Each static instruction's counts
+// are kept in an open-addressing hash table keyed by its PC, so a retiring
+// instruction costs one probe sequence and no allocation once the table has
+// grown to the number of static instructions.
+
+typedef enum {
+    HOTSPOT_HEAD,         // At the ROB head without having completed
+    HOTSPOT_OPERANDS,     // In the SchedQ waiting on source operands
+    HOTSPOT_DISAMBIG,     // Ready but held back by memory disambiguation
+    HOTSPOT_DCACHE_MISS,  // D-cache and L2 miss penalties
+    NUM_HOTSPOT_KINDS,
+} hotspot_kind_t;
+
+typedef struct {
+    uint64_t pc;
+    opcode_t opcode;
+    uint64_t retired;  // Dynamic instances retired
+    uint64_t cycles[NUM_HOTSPOT_KINDS];
+} hotspot_entry_t;
+
+/* Returns NULL on allocation failure */
+hotspot_table_t *hotspot_create(void);
+/* The entry for pc, inserting a zeroed one if there is none.
+ * Returns NULL on allocation failure */
+hotspot_entry_t *hotspot_lookup(hotspot_table_t *table, uint64_t pc, opcode_t opcode);
+/* forget every entry */
+void hotspot_clear(hotspot_table_t *table);
+/* Add src's counts into dst. Returns 0 on success, -1 on allocation failure */
+int hotspot_merge(hotspot_table_t *dst, const hotspot_table_t *src);
+/* Copy the (up to) n entries with the most stall cycles of all kinds into
+ * out, most first. Returns the number copied */
+size_t hotspot_top(const hotspot_table_t *table, size_t n, hotspot_entry_t *out);
+void hotspot_destroy(hotspot_table_t *table);
+
+#endif
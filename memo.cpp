@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.hpp"
+#include "memo.hpp"
+
+typedef struct {
+    uint64_t sig;
+    uint64_t head;
+    uint64_t cycle;
+} memo_slot_t;
+
+/* same instruction apart from its address, as far as timing goes */
+static inline bool same_inst(const inst_t *a, const inst_t *b) {
+    return a->pc == b->pc && a->opcode == b->opcode && a->dest == b->dest &&
+           a->src1 == b->src1 && a->src2 == b->src2 && a->mispredict == b->mispredict &&
+           a->icache_miss == b->icache_miss && a->dcache_miss == b->dcache_miss;
+}
+
+/* add times the counts since start to every counter in stats */
+static void extrapolate_stats(procsim_stats_t *stats, const procsim_stats_t *start, uint64_t times) {
+#define EXTRAPOLATE(field) stats->field += times * (stats->field - start->field)
+    EXTRAPOLATE(cycles);
+    EXTRAPOLATE(instructions_fetched);
+    EXTRAPOLATE(instructions_retired);
+    EXTRAPOLATE(branch_mispredictions);
+    EXTRAPOLATE(mispredict_recovery_cycles);
+    EXTRAPOLATE(icache_misses);
+    EXTRAPOLATE(reads);
+    EXTRAPOLATE(store_buffer_read_hits);
+    EXTRAPOLATE(dcache_reads);
+    EXTRAPOLATE(dcache_read_misses);
+    EXTRAPOLATE(dcache_read_hits);
+    EXTRAPOLATE(no_dispatch_pregs_cycles);
+    EXTRAPOLATE(rob_stall_cycles);
+    EXTRAPOLATE(dispq_full_cycles);
+    EXTRAPOLATE(no_fire_cycles);
+    for (int c = 0; c < NUM_CPI_CATEGORIES; c++) {
+        EXTRAPOLATE(cpi_slots[c]);
+    }
+    // Still the sums that procsim_finalize_stats() averages
+    EXTRAPOLATE(dispq_avg_size);
+    EXTRAPOLATE(schedq_avg_size);
+    EXTRAPOLATE(rob_avg_size);
+    for (int op = 0; op < NUM_OPCODES; op++) {
+        for (int k = 0; k < NUM_LATENCY_KINDS; k++) {
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                EXTRAPOLATE(latency_hist[op][k][b]);
+            }
+        }
+    }
+#undef EXTRAPOLATE
+}
+
+int memo_simulate(const procsim_conf_t *sim_conf, const inst_t *insts,
+                  size_t n_sim_insts, procsim_stats_t *sim_stats,
+                  memo_report_t *report) {
+    memo_slot_t *table = (memo_slot_t *)calloc(MEMO_TABLE_ENTRIES, sizeof(memo_slot_t));
+    procsim_stats_t *period_start = (procsim_stats_t *)malloc(sizeof(procsim_stats_t));
+    if (table == NULL || period_start == NULL) {
+        free(table);
+        free(period_start);
+        return -1;
+    }
+    memset(report, 0, sizeof *report);
+
+    trace_cursor_t c;
+    trace_cursor_init(&c, insts, n_sim_insts);
+    trace_cursor_select(&c);
+    procsim_init(sim_conf, sim_stats);
+
+    // A signature seen again one period ago, waiting to come back once more
+    bool armed = false;
+    uint64_t armed_sig = 0, armed_head = 0, armed_cycle = 0;
+    uint64_t period = 0, period_cycles = 0;
+    // A span being simulated to check its extrapolation
+    bool verifying = false;
+    uint64_t verify_end = 0, verify_cycle = 0, verify_predicted = 0;
+    uint64_t opportunities = 0;
+    uint64_t last_head = 0;
+
+    int ret = 0;
+    while (!trace_cursor_done(&c)) {
+        if (trace_cursor_cycle(sim_stats) != 0) {
+            ret = -1;
+            break;
+        }
+        uint64_t head = c.retired_inst_idx;
+        if (head == last_head || trace_cursor_done(&c)) continue;
+        last_head = head;
+        if (verifying) {
+            if (head < verify_end) continue;
+            uint64_t actual = sim_stats->cycles - verify_cycle;
+            double error = actual > verify_predicted ? actual - verify_predicted
+                                                     : verify_predicted - actual;
+            error /= verify_predicted;
+            if (error > report->max_error) report->max_error = error;
+            report->verified_spans++;
+            verifying = false;
+            if (error > MEMO_MAX_ERROR) report->disabled = true;
+            continue;
+        }
+        if (report->disabled) continue;
+        if (insts[head - 1].pc < insts[head].pc) continue;  // Not a loop head
+
+        uint64_t sig = procsim_state_signature(&insts[head]);
+        const uint64_t fetch_state[] = {
+            insts[head].pc, c.fetch_inst_idx - head, c.icache_miss_ctr,
+            (uint64_t)c.in_mispred << 16 | (uint64_t)c.in_icache_miss << 8 | c.finished_miss,
+        };
+        sig = fnv1a64(fetch_state, sizeof fetch_state, sig);
+
+        if (armed && head >= armed_head + period) {
+            armed = false;
+            if (head == armed_head + period && sig == armed_sig &&
+                    sim_stats->cycles - armed_cycle == period_cycles) {
+                // The period repeated, so count the periods the trace
+                // still repeats for past everything fetched so far
+                uint64_t end = head;
+                uint64_t limit = c.fetch_inst_idx + MEMO_MAX_SKIP_PERIODS * period;
+                if (limit > n_sim_insts) limit = n_sim_insts;
+                while (end < limit && same_inst(&insts[end], &insts[end - period])) end++;
+                uint64_t times = end > c.fetch_inst_idx ? (end - c.fetch_inst_idx) / period : 0;
+                if (times != 0 && ++opportunities % MEMO_VERIFY_INTERVAL == 0) {
+                    verifying = true;
+                    verify_end = head + times * period;
+                    verify_cycle = sim_stats->cycles;
+                    verify_predicted = times * period_cycles;
+                } else if (times != 0) {
+                    uint64_t skip = times * period;
+                    extrapolate_stats(sim_stats, period_start, times);
+                    c.fetch_inst_idx += skip;
+                    c.retired_inst_idx += skip;
+                    procsim_advance_trace(skip, &insts[c.retired_inst_idx]);
+                    last_head = c.retired_inst_idx;
+                    report->spans++;
+                    report->skipped_insts += skip;
+                    report->skipped_cycles += times * period_cycles;
+                    // Slots refer to positions that have been skipped over
+                    memset(table, 0, MEMO_TABLE_ENTRIES * sizeof(memo_slot_t));
+                }
+                continue;
+            }
+        }
+
+        // A state that came back since arming gives a shorter period, which
+        // replaces one matched against a stale slot from an earlier loop
+        memo_slot_t *slot = &table[sig % MEMO_TABLE_ENTRIES];
+        if (slot->sig == sig && slot->head != 0 && slot->head < head &&
+                (!armed || slot->head >= armed_head)) {
+            armed = true;
+            armed_sig = sig;
+            armed_head = head;
+            armed_cycle = sim_stats->cycles;
+            period = head - slot->head;
+            period_cycles = sim_stats->cycles - slot->cycle;
+            *period_start = *sim_stats;
+        }
+        slot->sig = sig;
+        slot->head = head;
+        slot->cycle = sim_stats->cycles;
+    }
+
+    sim_stats->instructions_in_trace = n_sim_insts;
+    procsim_finish(sim_stats);
+    free(table);
+    free(period_start);
+    return ret;
+}
@@ -0,0 +1,52 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "trace.hpp"
+
+// Loop steady-state memoization. Whenever retirement stops at a loop head
+// (an instruction reached by a backward branch), the pipeline state is
+// summarized as a signature of the ROB, SchedQ and FU occupancy relative to
+// the head, together with the fetch state. Once the same signature comes
+// back one period of P instructions and D cycles later, and then again after
+// another period of the same length, the rest of the trace is checked for
+// repeating with period P. Each period the trace goes on repeating is
+// skipped: every in-flight instruction moves P instructions ahead and the
+// stats gain the last period's counts, D cycles and all.
+//
+// The state repeats exactly, but the addresses of the skipped loads and
+// stores are not simulated, so store buffer forwarding inside a skipped span
+// is assumed to repeat as well. To bound that error every
+// MEMO_VERIFY_INTERVAL-th span that could be skipped is simulated in full
+// instead, and compared with what extrapolation would have predicted. Once a
+// verified span's cycles are off by more than MEMO_MAX_ERROR, nothing more is
+// skipped and the rest of the trace is simulated in full. The CPI stack's
+// slots are extrapolated like the other counts, but the record of stall
+// slots that a later burst of retirement may take back is not, so the stack
+// can differ slightly from a full simulation.
+
+#define MEMO_TABLE_ENTRIES 4096
+#define MEMO_MAX_SKIP_PERIODS 1024
+#define MEMO_VERIFY_INTERVAL 8
+#define MEMO_MAX_ERROR 0.01
+
+typedef struct {
+    uint64_t spans;  // Spans skipped
+    uint64_t skipped_insts;
+    uint64_t skipped_cycles;
+    uint64_t verified_spans;
+    // Largest relative error of a verified span's extrapolated cycles
+    double max_error;
+    // Skipping stopped after an error above MEMO_MAX_ERROR
+    bool disabled;
+} memo_report_t;
+
+/* Simulate the first n_sim_insts instructions of a trace like
+ * trace_simulate(), skipping repeated loop iterations, and fill in *report.
+ * Requires a configuration without MSHRs, L2, prefetcher or speculative
+ * disambiguation, whose state depends on addresses.
+ * Returns 0 on success and -1 on a deadlock or allocation failure */
+int memo_simulate(const procsim_conf_t *sim_conf, const inst_t *insts,
+                  size_t n_sim_insts, procsim_stats_t *sim_stats,
+                  memo_report_t *report);
+
+#endif
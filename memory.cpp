@@ -0,0 +1,70 @@
+#include <stdlib.h>
+
+#include "memory.hpp"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+struct memory {
+    cache_t *l2;
+    uint64_t l2_latency;
+    uint64_t dram_latency;
+    uint64_t dram_bank_busy;
+    size_t l2_banks;
+    size_t dram_banks;
+    // First cycle in which each bank can start another access
+    uint64_t *l2_bank_free;
+    uint64_t *dram_bank_free;
+};
+
+memory_t *memory_create(const procsim_conf_t *conf) {
+    memory_t *mem = (memory_t *)calloc(1, sizeof(memory_t));
+    if (mem == NULL) return NULL;
+    // A read takes at least a cycle, so that its penalty is never 0
+    mem->l2_latency = conf->l2_latency ? conf->l2_latency : 1;
+    mem->dram_latency = conf->dram_latency;
+    mem->dram_bank_busy = conf->dram_bank_busy;
+    mem->l2_banks = conf->l2_banks ? conf->l2_banks : 1;
+    mem->dram_banks = conf->dram_banks ? conf->dram_banks : 1;
+    mem->l2 = cache_create(conf->l2_size_kib * 1024, conf->l2_assoc ? conf->l2_assoc : 1);
+    mem->l2_bank_free = (uint64_t *)calloc(mem->l2_banks, sizeof(uint64_t));
+    mem->dram_bank_free = (uint64_t *)calloc(mem->dram_banks, sizeof(uint64_t));
+    if (mem->l2 == NULL || mem->l2_bank_free == NULL || mem->dram_bank_free == NULL) {
+        memory_destroy(mem);
+        return NULL;
+    }
+    return mem;
+}
+
+void memory_read(memory_t *mem, uint64_t addr, uint64_t now, memory_read_t *out) {
+    uint64_t line = addr / CACHE_LINE_SIZE;
+    uint64_t *l2_bank = &mem->l2_bank_free[line % mem->l2_banks];
+    uint64_t start = MAX(now, *l2_bank);
+    *l2_bank = start + MEMORY_L2_BANK_BUSY;
+    uint64_t done = start + mem->l2_latency;
+    out->l2_queue_cycles = start - now;
+    out->l2_miss = !cache_access(mem->l2, addr);
+    out->dram_cycles = 0;
+    out->dram_queue_cycles = 0;
+    if (out->l2_miss) {
+        uint64_t *dram_bank = &mem->dram_bank_free[line % mem->dram_banks];
+        uint64_t dram_start = MAX(done, *dram_bank);
+        *dram_bank = dram_start + mem->dram_bank_busy;
+        out->dram_queue_cycles = dram_start - done;
+        out->dram_cycles = dram_start + mem->dram_latency - done;
+        done = dram_start + mem->dram_latency;
+    }
+    out->cycles = done - now;
+}
+
+uint64_t memory_max_read_cycles(const memory_t *mem, size_t in_flight) {
+    return mem->l2_latency + mem->dram_latency +
+        in_flight * (MEMORY_L2_BANK_BUSY + mem->dram_bank_busy);
+}
+
+void memory_destroy(memory_t *mem) {
+    if (mem == NULL) return;
+    cache_destroy(mem->l2);
+    free(mem->l2_bank_free);
+    free(mem->dram_bank_free);
+    free(mem);
+}
@@ -0,0 +1,49 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "procsim.hpp"
+
+// Timing of a core's private L2 and DRAM behind the L1 D-cache. Both levels
+// are split into banks interleaved on the line address, and a bank starts one
+// access at a time, so misses to a busy bank queue behind the ones before
+// them. The L2 is a functional cache (see cache.hpp) and decides which reads
+// go on to DRAM.
+
+// Cycles an L2 bank is occupied by each access
+#define MEMORY_L2_BANK_BUSY 1
+
+// Defaults the driver fills in for the fields that are not given
+#define MEMORY_DEFAULT_L2_ASSOC 8
+#define MEMORY_DEFAULT_L2_LATENCY L1_MISS_PENALTY
+#define MEMORY_DEFAULT_L2_BANKS 4
+#define MEMORY_DEFAULT_DRAM_LATENCY 200
+#define MEMORY_DEFAULT_DRAM_BANKS 8
+#define MEMORY_DEFAULT_DRAM_BANK_BUSY 40
+
+// Largest values the driver accepts, which keep a read's cycles well within
+// memory_read_t even when it queues behind every other outstanding miss
+#define MEMORY_MAX_L2_KIB 65536
+#define MEMORY_MAX_L2_ASSOC 64
+#define MEMORY_MAX_LATENCY 10000
+#define MEMORY_MAX_BANKS 64
+
+typedef struct memory memory_t;
+
+// Timing of one read that missed the D-cache
+typedef struct {
+    uint32_t cycles;  // From the D-cache miss until the data is back
+    uint32_t l2_queue_cycles;  // Waiting for the L2 bank
+    uint32_t dram_cycles;  // Part of cycles spent past the L2, 0 on an L2 hit
+    uint32_t dram_queue_cycles;  // Waiting for the DRAM bank
+    bool l2_miss;
+} memory_read_t;
+
+/* Uses the l2_* and dram_* fields of conf. Returns NULL on allocation failure */
+memory_t *memory_create(const procsim_conf_t *conf);
+/* Read the line holding addr after a D-cache miss detected in cycle now */
+void memory_read(memory_t *mem, uint64_t addr, uint64_t now, memory_read_t *out);
+/* upper bound on a read's cycles while at most in_flight reads are queued */
+uint64_t memory_max_read_cycles(const memory_t *mem, size_t in_flight);
+void memory_destroy(memory_t *mem);
+
+#endif
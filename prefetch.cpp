@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.hpp"
+#include "prefetch.hpp"
+
+static const char *const prefetch_names[] = {"none", "next-line", "stride", "stream"};
+
+typedef struct {
+    uint64_t line;  // Line address + 1, 0 when the slot is empty
+    uint64_t ready;
+} pf_buffer_slot_t;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t last_addr;
+    int64_t stride;
+    unsigned confidence;
+} pf_stride_entry_t;
+
+typedef struct {
+    bool valid;
+    uint64_t last_line;
+    int dir;  // +1 or -1 once a second miss has given the direction, else 0
+    bool confirmed;
+    uint64_t last_use;  // For replacing the least recently used stream
+} pf_stream_t;
+
+struct prefetcher {
+    prefetch_kind_t kind;
+    size_t degree;
+    pf_buffer_slot_t buffer[PREFETCH_BUFFER_LINES];
+    pf_stride_entry_t stride[PREFETCH_STRIDE_ENTRIES];
+    pf_stream_t streams[PREFETCH_STREAMS];
+    uint64_t clock;
+};
+
+prefetcher_t *prefetch_create(prefetch_kind_t kind, size_t degree) {
+    if (kind == PREFETCH_NONE) {
+        return NULL;
+    }
+    prefetcher_t *pf = (prefetcher_t *)calloc(1, sizeof(prefetcher_t));
+    if (pf == NULL) return NULL;
+    pf->kind = kind;
+    pf->degree = degree;
+    return pf;
+}
+
+/* lines at step lines at a time after line, as a stride or stream predicts */
+static size_t lines_ahead(const prefetcher_t *pf, uint64_t line, int64_t step, uint64_t *lines_out) {
+    for (size_t k = 0; k < pf->degree; k++) {
+        lines_out[k] = line + (k + 1) * step;
+    }
+    return pf->degree;
+}
+
+static size_t train_stride(prefetcher_t *pf, uint64_t pc, uint64_t addr, uint64_t *lines_out) {
+    pf_stride_entry_t *e = &pf->stride[(pc >> 2) % PREFETCH_STRIDE_ENTRIES];
+    if (e->pc != pc) {
+        e->pc = pc;
+        e->last_addr = addr;
+        e->stride = 0;
+        e->confidence = 0;
+        return 0;
+    }
+    int64_t stride = (int64_t)(addr - e->last_addr);
+    e->last_addr = addr;
+    if (stride == e->stride) {
+        if (e->confidence < 3) e->confidence++;
+    } else if (e->confidence > 0) {
+        e->confidence--;
+    } else {
+        e->stride = stride;
+    }
+    if (e->confidence < PREFETCH_STRIDE_CONFIDENT || e->stride == 0) {
+        return 0;
+    }
+    // Strides within a line step a whole line at a time in their direction
+    int64_t step = e->stride;
+    if (step > -CACHE_LINE_SIZE && step < CACHE_LINE_SIZE) {
+        step = step > 0 ? CACHE_LINE_SIZE : -CACHE_LINE_SIZE;
+    }
+    size_t n = 0;
+    for (size_t k = 1; k <= pf->degree; k++) {
+        lines_out[n++] = (addr + k * step) / CACHE_LINE_SIZE;
+    }
+    return n;
+}
+
+static size_t train_stream(prefetcher_t *pf, uint64_t line, uint64_t *lines_out) {
+    pf->clock++;
+    pf_stream_t *victim = &pf->streams[0];
+    for (size_t i = 0; i < PREFETCH_STREAMS; i++) {
+        pf_stream_t *s = &pf->streams[i];
+        if (s->valid && line != s->last_line &&
+                line + PREFETCH_STREAM_WINDOW >= s->last_line &&
+                line <= s->last_line + PREFETCH_STREAM_WINDOW) {
+            int dir = line > s->last_line ? 1 : -1;
+            s->confirmed = dir == s->dir;
+            s->dir = dir;
+            s->last_line = line;
+            s->last_use = pf->clock;
+            return s->confirmed ? lines_ahead(pf, line, dir, lines_out) : 0;
+        }
+        if (!s->valid || (victim->valid && s->last_use < victim->last_use)) victim = s;
+    }
+    victim->valid = true;
+    victim->last_line = line;
+    victim->dir = 0;
+    victim->confirmed = false;
+    victim->last_use = pf->clock;
+    return 0;
+}
+
+size_t prefetch_train(prefetcher_t *pf, uint64_t pc, uint64_t addr, bool miss, uint64_t *lines_out) {
+    uint64_t line = addr / CACHE_LINE_SIZE;
+    switch (pf->kind) {
+        case PREFETCH_NEXT_LINE:
+            return miss ? lines_ahead(pf, line, 1, lines_out) : 0;
+        case PREFETCH_STRIDE:
+            return train_stride(pf, pc, addr, lines_out);
+        case PREFETCH_STREAM:
+            return miss ? train_stream(pf, line, lines_out) : 0;
+        default:
+            return 0;
+    }
+}
+
+bool prefetch_buffered(const prefetcher_t *pf, uint64_t line) {
+    return pf->buffer[line % PREFETCH_BUFFER_LINES].line == line + 1;
+}
+
+void prefetch_insert(prefetcher_t *pf, uint64_t line, uint64_t ready) {
+    pf_buffer_slot_t *slot = &pf->buffer[line % PREFETCH_BUFFER_LINES];
+    slot->line = line + 1;
+    slot->ready = ready;
+}
+
+bool prefetch_claim(prefetcher_t *pf, uint64_t addr, uint64_t *ready_out) {
+    uint64_t line = addr / CACHE_LINE_SIZE;
+    pf_buffer_slot_t *slot = &pf->buffer[line % PREFETCH_BUFFER_LINES];
+    if (slot->line != line + 1) {
+        return false;
+    }
+    slot->line = 0;
+    *ready_out = slot->ready;
+    return true;
+}
+
+void prefetch_destroy(prefetcher_t *pf) {
+    free(pf);
+}
+
+int prefetch_parse_kind(const char *name, prefetch_kind_t *kind_out) {
+    for (size_t i = 0; i < sizeof prefetch_names / sizeof prefetch_names[0]; i++) {
+        if (strcmp(name, prefetch_names[i]) == 0) {
+            *kind_out = (prefetch_kind_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *prefetch_kind_name(prefetch_kind_t kind) {
+    return prefetch_names[kind];
+}
@@ -0,0 +1,59 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Data prefetcher models. The trace's miss bits describe a D-cache without
+// prefetching, so prefetched lines are kept in a buffer beside it: a load
+// that the trace says misses is turned into a hit if its line was prefetched
+// and has arrived, and only waits for the rest of the fill if it has not.
+
+typedef enum {
+    PREFETCH_NONE = 0,
+    PREFETCH_NEXT_LINE,  // The lines after each miss
+    PREFETCH_STRIDE,     // Per-PC constant strides
+    PREFETCH_STREAM,     // Ascending or descending runs of missing lines
+} prefetch_kind_t;
+
+#define PREFETCH_DEFAULT_DEGREE 2
+#define PREFETCH_MAX_DEGREE 16
+
+// Direct-mapped buffer of prefetched lines that no load has used yet
+#define PREFETCH_BUFFER_LINES 256
+
+// Stride: PC-indexed table of the last address, stride and a 2-bit
+// confidence, which must reach PREFETCH_STRIDE_CONFIDENT to prefetch
+#define PREFETCH_STRIDE_ENTRIES 256
+#define PREFETCH_STRIDE_CONFIDENT 2
+
+// Stream: misses within PREFETCH_STREAM_WINDOW lines of a tracked stream's
+// last miss extend it, and two steps in a row in the same direction confirm
+// it
+#define PREFETCH_STREAMS 16
+#define PREFETCH_STREAM_WINDOW 16
+
+typedef struct prefetcher prefetcher_t;
+
+/* Returns NULL for PREFETCH_NONE or on allocation failure */
+prefetcher_t *prefetch_create(prefetch_kind_t kind, size_t degree);
+/* Train on a load or store to addr at pc, which the trace says missed the
+ * D-cache or not. Writes the (up to degree) lines to prefetch into lines_out
+ * and returns how many */
+size_t prefetch_train(prefetcher_t *pf, uint64_t pc, uint64_t addr, bool miss, uint64_t *lines_out);
+/* true if line was prefetched and has not been used yet */
+bool prefetch_buffered(const prefetcher_t *pf, uint64_t line);
+/* Record a prefetch of line whose data arrives in cycle ready */
+void prefetch_insert(prefetcher_t *pf, uint64_t line, uint64_t ready);
+/* If the line holding addr was prefetched and not used yet, use it up and
+ * return true with the cycle its data arrives */
+bool prefetch_claim(prefetcher_t *pf, uint64_t addr, uint64_t *ready_out);
+void prefetch_destroy(prefetcher_t *pf);
+
+/* Parse a prefetcher name (none, next-line, stride, stream).
+ * Returns 0 on success, -1 on unknown name */
+int prefetch_parse_kind(const char *name, prefetch_kind_t *kind_out);
+const char *prefetch_kind_name(prefetch_kind_t kind);
+
+#endif
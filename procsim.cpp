@@ -7,16 +7,29 @@
 #include <stdlib.h>
 
 #include "procsim.hpp"
+#include "cache.hpp"
+#include "hash.hpp"
+#include "hotspot.hpp"
+#include "memory.hpp"
+#include "prefetch.hpp"
 
 
 
 //
 // TODO: Define any useful data structures and functions here
 //
-// qentry_t is used for all queue data structures
-
-
-
+// qentry_t holds the state of one in-flight instruction. Entries live in the
+// ROB ring from dispatch until retirement, and the SchedQ, the FU pipes and
+// the preg wakeup lists only link to them, so no stage ever has to search a
+// queue for an instruction. This keeps the per-cycle cost independent of the
+// ROB, SchedQ and preg counts.
+
+// Links of the intrusive SchedQ lists that an entry can be on
+enum {
+    LINK_MEM,    // Loads and stores in the SchedQ
+    LINK_STORE,  // Stores in the SchedQ
+    NUM_LINKS,
+};
 
 typedef struct queue_entry {
     const inst_t *inst;
@@ -24,168 +37,405 @@ typedef struct queue_entry {
     int src2_preg;
     int dest_preg;
     int prev_preg;
-    uint8_t exec_cycle;
+    uint32_t exec_cycle;
     bool store_buffer_hit;
+    bool l2_miss;
     bool fired;
     bool completed;
-    struct queue_entry *next;
+    // Waiting in an MSHR for a line fill, and whether it joined another
+    // load's miss rather than missing itself
+    bool in_mshr;
+    bool mshr_merged;
+    // A D-cache read miss that found its line prefetched, in time or not
+    bool prefetch_hit;
+    bool prefetch_late;
+    // A load that fired past an older store that had not executed, and one
+    // that read before such a store wrote its address
+    bool speculated;
+    bool violated;
+    // Store that the load's store set makes it wait for, as its
+    // dyn_instruction_count + 1, or 0
+    uint64_t store_set_wait;
+    // Number of source pregs that are not ready yet
+    uint8_t pending_srcs;
+    // Cycles a D-cache read miss waits for its data after the tag check, 0
+    // until read_miss_penalty() works it out
+    uint32_t miss_penalty;
+    memory_read_t mem_read;  // Only filled in with a private L2
+    // Cycles in which the instruction was dispatched, fired and completed
+    uint64_t dispatch_cycle;
+    uint64_t ready_cycle;  // When the last source operand became ready
+    uint64_t fire_cycle;
+    uint64_t complete_cycle;
+    // Only counted with a hotspot profile attached
+    uint32_t head_cycles;
+    uint32_t disambig_cycles;
+    // Next link in the wakeup list of the src1 (0) and src2 (1) pregs, see
+    // wait_on_preg()
+    int32_t wait_next[2];
+    struct queue_entry *prev[NUM_LINKS];
+    struct queue_entry *next[NUM_LINKS];
+    struct queue_entry *mshr_next;  // Next load waiting on the same MSHR
 } qentry_t;
 
-typedef struct queue {
+// Outstanding D-cache miss. Loads that miss leave the LSU once their tag
+// check is done and wait here for the fill, so the LSU serves other loads
+// meanwhile, and later loads to the same line wait on the same fill
+typedef struct mshr {
+    bool busy;
+    uint64_t line;
+    uint64_t fill_cycle;
+    qentry_t *waiters;
+} mshr_t;
+
+// Program-ordered list of SchedQ entries threaded through one of the links
+typedef struct qlist {
     qentry_t *head;
     qentry_t *tail;
+} qlist_t;
+
+// FU pipeline holding up to max_size entries, oldest at stages[head]
+typedef struct fu {
+    qentry_t *stages[MUL_STAGES];
+    size_t head;
+    size_t size;
     size_t max_size;
+} fu_t;
+
+// Ready-to-fire entries of one FU class, as a binary min-heap on the
+// dynamic instruction count so that they fire in program order
+typedef struct ready_heap {
+    qentry_t **items;
+    size_t size;
+} ready_heap_t;
+
+// Growable ring of fetched instructions waiting for dispatch
+typedef struct inst_ring {
+    const inst_t **buf;
+    size_t cap;  // Always a power of two
+    size_t head;
     size_t size;
-} queue_t;
-
-queue_t qdisp;  // Dispatch queue
-queue_t qrob;  // ROB queue
-queue_t qsched;  // Schedule queue
-queue_t qstb;  // Store Buffer queue
-queue_t *qalu_fus;  // List of ALU FU pipes
-size_t NUM_ALU_FUS;
-queue_t *qmul_fus;  // List of MUL FU pipes
-size_t NUM_MUL_FUS;
-queue_t *qlsu_fus;  // List of LSU FU pipes
-size_t NUM_LSU_FUS;
-bool in_mispredict = false;
+} inst_ring_t;
+
+// Counts of the addresses in the store buffer, as an open-addressing hash
+// table with linear probing. A count of 0 marks an empty slot
+typedef struct stb_slot {
+    uint64_t addr;
+    uint32_t count;
+} stb_slot_t;
 
 typedef struct reg {
     bool free;
     bool ready;
 } reg_t;
 
-unsigned long RAT[32];
-struct reg *reg_file;
-size_t FETCH_WIDTH;
-size_t NUM_PREGS;
-
-/* initialize queue, pass max_size == -1 for unlimited size */
-void queue_init(queue_t *queue, size_t max_size) {
-    queue->head = NULL;
-    queue->tail = NULL;
-    queue->max_size = max_size;
-    queue->size = 0;
-}
-
-/* copy all values of qentry src to dst */
-void qentry_copy(qentry_t *src, qentry_t *dst) {
-    dst->inst = src->inst;
-    dst->src1_preg = src->src1_preg;
-    dst->src2_preg = src->src2_preg;
-    dst->dest_preg = src->dest_preg;
-    dst->prev_preg = src->prev_preg;
-    dst->exec_cycle = src->exec_cycle;
-    dst->store_buffer_hit = src->store_buffer_hit;
-    dst->fired = src->fired;
-    dst->completed = src->completed;
-}
-
-/* insert entry at the tail of the FIFO queue.
- * Returns 0 on success
- * Returns -1 on full queue
- */
-int fifo_insert_tail(queue_t *q, qentry_t *entry) {
-    // Check if fifo is full
-    if (q->max_size >= 0 && q->size >= q->max_size) {
-        return -1;
+// All pipeline state of one simulated core
+struct procsim_core {
+    qentry_t *rob;  // ROB ring, allocated entries are [rob_head, rob_head + rob_size)
+    size_t rob_head;
+    size_t rob_size;
+    size_t ROB_ENTRIES;
+    inst_ring_t qdisp;  // Dispatch queue
+    size_t DISPQ_ENTRIES;  // 0 when the dispatch queue is unbounded
+    size_t sched_size;  // Entries in the schedule queue
+    size_t SCHED_ENTRIES;
+    qlist_t sched_lists[NUM_LINKS];
+    ready_heap_t alu_ready;
+    ready_heap_t mul_ready;
+    ready_heap_t lsu_ready;
+    fu_t *qalu_fus;  // List of ALU FU pipes
+    size_t NUM_ALU_FUS;
+    fu_t *qmul_fus;  // List of MUL FU pipes
+    size_t NUM_MUL_FUS;
+    fu_t *qlsu_fus;  // List of LSU FU pipes
+    size_t NUM_LSU_FUS;
+    uint64_t *stb_addrs;  // Store buffer FIFO ring of store addresses
+    size_t stb_head;
+    size_t stb_size;
+    stb_slot_t *stb_table;
+    size_t STB_TABLE_MASK;
+    bool in_mispredict;
+    bool in_icache_miss_local;
+    // CPI stack causes: what last starved the front end, and what held back
+    // dispatch and scheduling last cycle (CPI_RETIRING for nothing)
+    cpi_category_t frontend_cause;
+    cpi_category_t dispatch_stall;
+    cpi_category_t schedule_stall;
+    // Stall slots charged since they were last handed back, and to what
+    uint64_t cpi_unrepaid[NUM_CPI_CATEGORIES];
+    cpi_category_t cpi_last_cause;
+    hotspot_table_t *hotspots;  // NULL unless a profile is attached
+    mshr_t *mshrs;
+    size_t NUM_MSHRS;  // 0 when a miss blocks its LSU until the fill
+    size_t mshrs_busy;
+    // Stores retired last cycle, whose store buffer entries are popped this cycle
+    int STORES_COMPLETED;
+
+    unsigned long RAT[32];
+    struct reg *reg_file;
+    uint64_t *free_preg_bits;  // Bit set for each free preg, to find the lowest quickly
+    int32_t *preg_waiters;  // Head of each preg's wakeup list
+    size_t FETCH_WIDTH;
+    size_t NUM_PREGS;
+    bool LATENCY_HISTOGRAMS;
+    // Cycle being simulated. Unlike stats->cycles it is never reset, so
+    // latencies stay correct across a warm-up's stats reset
+    uint64_t cycle;
+
+    // Shared L2 that D-cache misses go on to, NULL when there is none
+    shared_l2_t *l2;
+    size_t l2_core_id;
+    // Private L2 and DRAM, NULL when there are none
+    memory_t *memory;
+    prefetcher_t *prefetcher;  // NULL without a data prefetcher
+    disambig_policy_t DISAMBIG_POLICY;
+    store_sets_t *store_sets;  // NULL unless the policy uses them
+    size_t speculated_loads;  // In flight
+    // Ready memory ops set aside while the younger ones are tried
+    qentry_t **lsu_held;
+    bool EARLY_RECOVERY;
+    size_t REDIRECT_PENALTY;
+    // With early recovery, where fetch restarts once a mispredicted branch
+    // has completed, and in which cycle. NULL when no redirect is pending
+    const inst_t *redirect_inst;
+    uint64_t redirect_cycle;
+};
+
+// Core that the stages of the calling thread act on
+static thread_local procsim_core_t *core;
+
+/* index of the ROB entry that is i entries past the head */
+static inline size_t rob_index(size_t i) {
+    size_t idx = core->rob_head + i;
+    return idx >= core->ROB_ENTRIES ? idx - core->ROB_ENTRIES : idx;
+}
+
+/* append entry at the tail of the program-ordered list */
+void qlist_append(qlist_t *list, qentry_t *entry, int link) {
+    entry->prev[link] = list->tail;
+    entry->next[link] = NULL;
+    if (list->tail != NULL) {
+        list->tail->next[link] = entry;
+    } else {
+        list->head = entry;
     }
-    if (q->head == NULL) {
-        q->head = entry;
+    list->tail = entry;
+}
+
+/* unlink entry from anywhere in the list */
+void qlist_remove(qlist_t *list, qentry_t *entry, int link) {
+    if (entry->prev[link] != NULL) {
+        entry->prev[link]->next[link] = entry->next[link];
+    } else {
+        list->head = entry->next[link];
     }
-    if (q->tail != NULL) {
-        q->tail->next = entry;
+    if (entry->next[link] != NULL) {
+        entry->next[link]->prev[link] = entry->prev[link];
+    } else {
+        list->tail = entry->prev[link];
     }
-    entry->next = NULL;
-    q->tail = entry;
-    q->size++;
+}
+
+/* add a ready entry to the heap */
+void heap_push(ready_heap_t *heap, qentry_t *entry) {
+    size_t i = heap->size++;
+    uint64_t key = entry->inst->dyn_instruction_count;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->items[parent]->inst->dyn_instruction_count <= key) break;
+        heap->items[i] = heap->items[parent];
+        i = parent;
+    }
+    heap->items[i] = entry;
+}
+
+/* remove the oldest entry from the heap */
+void heap_pop(ready_heap_t *heap) {
+    qentry_t *last = heap->items[--heap->size];
+    uint64_t key = last->inst->dyn_instruction_count;
+    size_t i = 0;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->size) break;
+        if (child + 1 < heap->size &&
+                heap->items[child + 1]->inst->dyn_instruction_count <
+                heap->items[child]->inst->dyn_instruction_count) {
+            child++;
+        }
+        if (key <= heap->items[child]->inst->dyn_instruction_count) break;
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    heap->items[i] = last;
+}
+
+/* append the n contiguous instructions at insts to the ring, growing it when
+ * they do not fit. Returns 0 on success, -1 on allocation failure */
+int inst_ring_push_span(inst_ring_t *ring, const inst_t *insts, size_t n) {
+    if (ring->size + n > ring->cap) {
+        size_t new_cap = ring->cap ? 2 * ring->cap : 64;
+        while (new_cap < ring->size + n) new_cap *= 2;
+        const inst_t **new_buf = (const inst_t **)malloc(new_cap * sizeof(const inst_t *));
+        if (new_buf == NULL) return -1;
+        for (size_t i = 0; i < ring->size; i++) {
+            new_buf[i] = ring->buf[(ring->head + i) & (ring->cap - 1)];
+        }
+        free(ring->buf);
+        ring->buf = new_buf;
+        ring->cap = new_cap;
+        ring->head = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        ring->buf[(ring->head + ring->size + i) & (ring->cap - 1)] = &insts[i];
+    }
+    ring->size += n;
     return 0;
 }
 
-/* pop the FIFO queue head.
- * Returns NULL if FIFO is empty
- */
-qentry_t *fifo_pop_head(queue_t *q) {
-    if (q->head == NULL) {
-        return NULL;
+/* oldest instruction in the ring, or NULL when it is empty */
+static inline const inst_t *inst_ring_head(const inst_ring_t *ring) {
+    return ring->size ? ring->buf[ring->head] : NULL;
+}
+
+static inline void inst_ring_pop(inst_ring_t *ring) {
+    ring->head = (ring->head + 1) & (ring->cap - 1);
+    ring->size--;
+}
+
+/* store buffer hash table slot for addr */
+static inline size_t stb_hash(uint64_t addr) {
+    return (size_t)((addr * 0x9e3779b97f4a7c15ULL) >> 32) & core->STB_TABLE_MASK;
+}
+
+/* true if a store to addr is in the store buffer */
+bool stb_contains(uint64_t addr) {
+    for (size_t i = stb_hash(addr); core->stb_table[i].count; i = (i + 1) & core->STB_TABLE_MASK) {
+        if (core->stb_table[i].addr == addr) return true;
     }
-    qentry_t *entry = q->head;
-    q->head = entry->next;
-    if (q->tail == entry) q->tail = NULL;
-    entry->next = NULL;
-    q->size--;
-    return entry;
+    return false;
 }
 
-/* Search a queue by unique instruction ID 
- * Returns NULL when not found
- */
-qentry_t *search_queue(queue_t *q, uint64_t dyn_instruction_count) {
-    qentry_t *entry = q->head;
-    while (entry != NULL) {
-        if (entry->inst->dyn_instruction_count == dyn_instruction_count) {
-            return entry;
+/* add a store to the tail of the store buffer */
+void stb_push(uint64_t addr) {
+    size_t tail = core->stb_head + core->stb_size;
+    core->stb_addrs[tail >= core->ROB_ENTRIES ? tail - core->ROB_ENTRIES : tail] = addr;
+    core->stb_size++;
+    size_t i = stb_hash(addr);
+    while (core->stb_table[i].count && core->stb_table[i].addr != addr) {
+        i = (i + 1) & core->STB_TABLE_MASK;
+    }
+    core->stb_table[i].addr = addr;
+    core->stb_table[i].count++;
+}
+
+/* drop one count of addr from the store buffer hash table */
+static void stb_table_remove(uint64_t addr) {
+    size_t i = stb_hash(addr);
+    while (core->stb_table[i].addr != addr || !core->stb_table[i].count) {
+        i = (i + 1) & core->STB_TABLE_MASK;
+    }
+    if (--core->stb_table[i].count) return;
+    // Backward shift deletion keeps every probe sequence unbroken
+    size_t hole = i;
+    for (size_t j = (i + 1) & core->STB_TABLE_MASK; core->stb_table[j].count; j = (j + 1) & core->STB_TABLE_MASK) {
+        size_t home = stb_hash(core->stb_table[j].addr);
+        if (((j - home) & core->STB_TABLE_MASK) >= ((j - hole) & core->STB_TABLE_MASK)) {
+            core->stb_table[hole] = core->stb_table[j];
+            core->stb_table[j].count = 0;
+            hole = j;
         }
-        entry = entry->next;
     }
-    return NULL;
 }
 
-/* Search a queue by unique instruction ID and pop that entry
- * Returns NULL when not found
- */
-qentry_t *fifo_search_and_pop(queue_t *q, uint64_t dyn_instruction_count) {
-    qentry_t *entry = q->head;
-    if (entry == NULL) return NULL;
-    // Special case it's at the head
-    if (entry->inst->dyn_instruction_count == dyn_instruction_count) {
-        return fifo_pop_head(q);
-    }
-    qentry_t *prev = entry;
-    entry = entry->next;
-    while (entry != NULL) {
-        if (entry->inst->dyn_instruction_count == dyn_instruction_count) {
-            // Special case it's at the tail
-            if (q->tail == entry) {
-                q->tail = prev;
-            }
-            prev->next = entry->next;
-            q->size--;
-            entry->next = NULL;
-            return entry;
+/* remove the oldest store from the store buffer */
+void stb_pop(void) {
+    uint64_t addr = core->stb_addrs[core->stb_head];
+    core->stb_head = core->stb_head + 1 == core->ROB_ENTRIES ? 0 : core->stb_head + 1;
+    core->stb_size--;
+    stb_table_remove(addr);
+}
+
+/* remove the youngest store from the store buffer */
+static void stb_pop_newest(void) {
+    size_t tail = core->stb_head + core->stb_size - 1;
+    core->stb_size--;
+    stb_table_remove(core->stb_addrs[tail >= core->ROB_ENTRIES ? tail - core->ROB_ENTRIES : tail]);
+}
+
+/* lowest numbered free preg, or -1 if there is none */
+int find_free_preg(void) {
+    size_t num_words = (NUM_REGS + core->NUM_PREGS + 63) / 64;
+    for (size_t w = NUM_REGS / 64; w < num_words; w++) {
+        if (core->free_preg_bits[w]) {
+            return w * 64 + __builtin_ctzll(core->free_preg_bits[w]);
+        }
+    }
+    return -1;
+}
+
+static inline void set_preg_free(int preg, bool free) {
+    core->reg_file[preg].free = free;
+    if (free) {
+        core->free_preg_bits[preg / 64] |= (uint64_t)1 << (preg % 64);
+    } else {
+        core->free_preg_bits[preg / 64] &= ~((uint64_t)1 << (preg % 64));
+    }
+}
+
+/* ready heap of the FU class that executes the entry */
+static ready_heap_t *ready_heap_for(const qentry_t *entry) {
+    switch (entry->inst->opcode) {
+        case OPCODE_MUL:
+            return &core->mul_ready;
+        case OPCODE_LOAD:
+        case OPCODE_STORE:
+            return &core->lsu_ready;
+        default:
+            return &core->alu_ready;
+    }
+}
+
+/* Put entry on the wakeup list of preg for source slot src (0 or 1). Links
+ * encode the ROB index and the slot as 2 * index + slot, and -1 ends a list */
+void wait_on_preg(qentry_t *entry, int preg, int src) {
+    entry->wait_next[src] = core->preg_waiters[preg];
+    core->preg_waiters[preg] = 2 * (entry - core->rob) + src;
+    entry->pending_srcs++;
+}
+
+/* Mark preg ready and move every entry that was only waiting on it to its
+ * FU class's ready heap */
+void wake_waiters(int preg) {
+    core->reg_file[preg].ready = 1;
+    int32_t link = core->preg_waiters[preg];
+    core->preg_waiters[preg] = -1;
+    while (link >= 0) {
+        qentry_t *entry = &core->rob[link / 2];
+        link = entry->wait_next[link % 2];
+        if (--entry->pending_srcs == 0) {
+            entry->ready_cycle = core->cycle;
+            heap_push(ready_heap_for(entry), entry);
         }
-        prev = entry;
-        entry = entry->next;
     }
-    return NULL;
 }
 
 /* Searches through a list of FU pipelines for a FU with an open
  * first stage.
  * Returns NULL when not found
  */
-queue_t *find_free_fu(queue_t *fus, size_t num_fus) {
+fu_t *find_free_fu(fu_t *fus, size_t num_fus) {
     for (size_t i = 0; i < num_fus; i++) {
         if (fus[i].size >= fus[i].max_size) {
             continue;
         }
-        if (fus[i].tail == NULL || fus[i].tail->exec_cycle >= 1) {
+        if (fus[i].size == 0 ||
+                fus[i].stages[(fus[i].head + fus[i].size - 1) % MUL_STAGES]->exec_cycle >= 1) {
             return &(fus[i]);
         }
     }
     return NULL;
 }
 
-/* Copies the entry and places it at the tail of the queue
- * Returns pointer to the new copy
- */
-qentry_t *fifo_insert_copy_tail(queue_t *q, qentry_t *entry) {
-    qentry_t *new_entry = (qentry_t *)malloc(sizeof(qentry_t));
-    qentry_copy(entry, new_entry);
-    fifo_insert_tail(q, new_entry);
-    return new_entry;
-}
-
 
 // The helper functions in this#ifdef are optional and included here for your
 // convenience so you can spend more time writing your simulator logic and less
@@ -218,26 +468,26 @@ static void print_instruction(const inst_t *inst) {
 static void print_rat(void) {
     for (uint64_t regno = 0; regno < NUM_REGS; regno++) {
         if (regno == 0) {
-            printf("    { R%02" PRIu64 ": P%03" PRIu64 " }", regno, RAT[regno]); // TODO: fix me
+            printf("    { R%02" PRIu64 ": P%03" PRIu64 " }", regno, core->RAT[regno]); // TODO: fix me
         } else if (!(regno & 0x3)) {
-            printf("\n    { R%02" PRIu64 ": P%03" PRIu64 " }", regno, RAT[regno]); //  TODO: fix me
+            printf("\n    { R%02" PRIu64 ": P%03" PRIu64 " }", regno, core->RAT[regno]); //  TODO: fix me
         } else {
-            printf(", { R%02" PRIu64 ": P%03" PRIu64 " }", regno, RAT[regno]); //  TODO: fix me
+            printf(", { R%02" PRIu64 ": P%03" PRIu64 " }", regno, core->RAT[regno]); //  TODO: fix me
         }
     }
     printf("\n"); //  PROVIDED
 }
 
-// This will print out the state of the register file, where P0-P31 are architectural registers 
-// and P32 is the first PREG 
+// This will print out the state of the register file, where P0-P31 are architectural registers
+// and P32 is the first PREG
 static void print_prf(void) {
-    for (uint64_t regno = 0; regno < 32 + NUM_PREGS; regno++) { // TODO: fix me
+    for (uint64_t regno = 0; regno < 32 + core->NUM_PREGS; regno++) { // TODO: fix me
         if (regno == 0) {
-            printf("    { P%03" PRIu64 ": Ready: %d, Free: %d }", regno, reg_file[regno].ready, reg_file[regno].free); // TODO: fix me
+            printf("    { P%03" PRIu64 ": Ready: %d, Free: %d }", regno, core->reg_file[regno].ready, core->reg_file[regno].free); // TODO: fix me
         } else if (!(regno & 0x3)) {
-            printf("\n    { P%03" PRIu64 ": Ready: %d, Free: %d }", regno, reg_file[regno].ready, reg_file[regno].free);
+            printf("\n    { P%03" PRIu64 ": Ready: %d, Free: %d }", regno, core->reg_file[regno].ready, core->reg_file[regno].free);
         } else {
-            printf(", { P%03" PRIu64 ": Ready: %d, Free: %d }", regno, reg_file[regno].ready, reg_file[regno].free);
+            printf(", { P%03" PRIu64 ": Ready: %d, Free: %d }", regno, core->reg_file[regno].ready, core->reg_file[regno].free);
         }
     }
     printf("\n"); //  PROVIDED
@@ -246,8 +496,9 @@ static void print_prf(void) {
 // This will print the state of the ROB where instructions are identified by their dyn_instruction_count
 static void print_rob(void) {
     size_t printed_idx = 0;
-    printf("\tAllocated Entries in ROB: %lu\n", qrob.size); // TODO: Fix Me
-    for (qentry_t *entry = qrob.head; entry != NULL; entry = entry->next) { // TODO: Fix Me
+    printf("\tAllocated Entries in ROB: %lu\n", core->rob_size); // TODO: Fix Me
+    for (size_t i = 0; i < core->rob_size; i++) { // TODO: Fix Me
+        qentry_t *entry = &core->rob[rob_index(i)];
         if (printed_idx == 0) {
             printf("    { dyncount=%05" PRIu64 ", completed: %d, mispredict: %d }", entry->inst->dyn_instruction_count, entry->completed, entry->inst->mispredict); // TODO: Fix Me
         } else if (!(printed_idx & 0x3)) {
@@ -265,108 +516,263 @@ static void print_rob(void) {
 #endif
 
 
-/* Try to fire the instruction from the RS 
+/* Try to fire the oldest ready instruction of an FU class
  * Returns 0 on successful fire
- * Returns -1 on instruction not ready
+ * Returns -1 on no ready instruction
  * Returns -2 on no free FUs
  */
-int try_fire(queue_t *fus, size_t num_fus, qentry_t *entry) {
+int try_fire(fu_t *fus, size_t num_fus, ready_heap_t *ready) {
+    if (ready->size == 0) {
+        return -1;
+    }
+    qentry_t *entry = ready->items[0];
 #ifdef DEBUG
     printf("\tAttempting to fire instruction: ");
     print_instruction(entry->inst);
     printf("\n");
 #endif
-    // Check if src pregs are ready
-    if (entry->src1_preg < 0 || reg_file[entry->src1_preg].ready) {
-        if (entry->src2_preg < 0 || reg_file[entry->src2_preg].ready) {
-            // Instruction is ready, is there a free FU?
-            queue_t *free_fu = find_free_fu(fus, num_fus);
-            if (free_fu == NULL) {
-                return -2;  // Stop scheduling because all FUs are taken
-            }
-            // Insert a copy into the pipeline
-            qentry_t *fu_entry = fifo_insert_copy_tail(free_fu, entry);
-            fu_entry->exec_cycle = 0;
+    fu_t *free_fu = find_free_fu(fus, num_fus);
+    if (free_fu == NULL) {
+        return -2;  // Stop scheduling because all FUs are taken
+    }
+    // Insert into the pipeline
+    heap_pop(ready);
+    free_fu->stages[(free_fu->head + free_fu->size) % MUL_STAGES] = entry;
+    free_fu->size++;
+    entry->exec_cycle = 0;
+    entry->fired = true;
+    entry->fire_cycle = core->cycle;
 #ifdef DEBUG
-            printf("\t\tFired\n");
+    printf("\t\tFired\n");
 #endif
-            return 0;
+    return 0;
+}
+
+/* free the entry's RS, mark it completed and wake its consumers */
+static void complete_entry(qentry_t *entry) {
+    // Remove from the RS
+    core->sched_size--;
+    if (entry->inst->opcode == OPCODE_LOAD || entry->inst->opcode == OPCODE_STORE) {
+        qlist_remove(&core->sched_lists[LINK_MEM], entry, LINK_MEM);
+    }
+    if (entry->inst->opcode == OPCODE_STORE) {
+        qlist_remove(&core->sched_lists[LINK_STORE], entry, LINK_STORE);
+    }
+    entry->completed = true;  // Mark ROB entry as completed
+    entry->complete_cycle = core->cycle;
+    if (entry->inst->mispredict && core->EARLY_RECOVERY) {
+        // The mispredict has resolved, so fetch can leave the wrong path.
+        // Traces mark the odd non-branch too, which resolves the same way
+        core->redirect_inst = entry->inst + 1;
+        core->redirect_cycle = core->cycle + core->REDIRECT_PENALTY;
+        core->frontend_cause = CPI_MISPREDICT;
+    }
+    // Mark preg as ready
+    if (entry->dest_preg >= 0) {
+        wake_waiters(entry->dest_preg);
+    }
+}
+
+/* whether a load misses the D-cache, which a timely prefetch prevents */
+static inline bool dcache_miss(const qentry_t *entry) {
+    return entry->inst->dcache_miss && !entry->prefetch_hit;
+}
+
+/* the busy MSHR filling the line, or NULL */
+static mshr_t *find_mshr(uint64_t line) {
+    for (size_t i = 0; i < core->NUM_MSHRS; i++) {
+        if (core->mshrs[i].busy && core->mshrs[i].line == line) return &core->mshrs[i];
+    }
+    return NULL;
+}
+
+/* cycles from a D-cache read miss's tag check until its data is back. The
+ * first call sends the read on to the private L2, if there is one */
+static uint32_t read_miss_penalty(qentry_t *entry) {
+    if (entry->miss_penalty != 0) return entry->miss_penalty;
+    if (core->memory != NULL) {
+        // The tag check ends in the entry's L1_HIT_TIME'th cycle in the LSU
+        memory_read(core->memory, entry->inst->load_store_addr,
+                    core->cycle + L1_HIT_TIME - entry->exec_cycle, &entry->mem_read);
+        entry->l2_miss = entry->mem_read.l2_miss;
+        entry->miss_penalty = entry->mem_read.cycles;
+    } else {
+        entry->miss_penalty = L1_MISS_PENALTY + (entry->l2_miss ? L2_MISS_PENALTY : 0);
+    }
+    return entry->miss_penalty;
+}
+
+// Trains the prefetcher on a load or store in its first LSU cycle and issues
+// the prefetches it asks for. A load that misses uses up its line if it was
+// prefetched: it hits if the prefetch has arrived, and otherwise waits for it
+// rather than missing anew. Prefetches go to the private L2 when there is one
+// and take L1_MISS_PENALTY cycles otherwise, without using an MSHR.
+static void prefetch_access(procsim_stats_t *stats, qentry_t *entry) {
+    uint64_t addr = entry->inst->load_store_addr;
+    // Misses and prefetches leave at the end of the tag check
+    uint64_t now = core->cycle + L1_HIT_TIME - 1;
+    uint64_t ready;
+    if (entry->inst->opcode == OPCODE_LOAD && entry->inst->dcache_miss &&
+            prefetch_claim(core->prefetcher, addr, &ready)) {
+        if (ready <= now) {
+            entry->prefetch_hit = true;
+        } else {
+            entry->prefetch_late = true;
+            entry->miss_penalty = ready - now;
         }
     }
-    return -1;
+    uint64_t lines[PREFETCH_MAX_DEGREE];
+    size_t n = prefetch_train(core->prefetcher, entry->inst->pc, addr, entry->inst->dcache_miss, lines);
+    for (size_t i = 0; i < n; i++) {
+        if (lines[i] == addr / CACHE_LINE_SIZE || prefetch_buffered(core->prefetcher, lines[i])) {
+            continue;
+        }
+        uint64_t latency = L1_MISS_PENALTY;
+        if (core->memory != NULL) {
+            memory_read_t read;
+            memory_read(core->memory, lines[i] * CACHE_LINE_SIZE, now, &read);
+            latency = read.cycles;
+        }
+        prefetch_insert(core->prefetcher, lines[i], now + latency);
+        stats->prefetches_issued++;
+    }
+}
+
+// Called for a load at the end of its tag check. Moves a miss to the MSHR
+// already filling its line, or else to a free MSHR, and returns true if it
+// did. Hits never touch the MSHRs, even on a line that is being filled, as
+// the trace records whether each access hit. A miss with every MSHR busy
+// stays in its LSU, repeating the end of its tag check until one frees up.
+static bool try_enter_mshr(procsim_stats_t *stats, qentry_t *entry) {
+    if (!dcache_miss(entry)) {
+        return false;  // Hit
+    }
+    uint64_t line = entry->inst->load_store_addr / CACHE_LINE_SIZE;
+    mshr_t *mshr = find_mshr(line);
+    if (mshr != NULL) {
+        entry->mshr_merged = true;
+    } else {
+        for (size_t i = 0; i < core->NUM_MSHRS && mshr == NULL; i++) {
+            if (!core->mshrs[i].busy) mshr = &core->mshrs[i];
+        }
+        if (mshr == NULL) {
+            entry->exec_cycle--;
+            stats->mshr_full_cycles++;
+            return false;
+        }
+        mshr->busy = true;
+        mshr->line = line;
+        mshr->fill_cycle = core->cycle + read_miss_penalty(entry);
+        mshr->waiters = NULL;
+        core->mshrs_busy++;
+    }
+    entry->in_mshr = true;
+    entry->mshr_next = mshr->waiters;
+    mshr->waiters = entry;
+    return true;
 }
 
-void progress_function_units(queue_t *rs, queue_t *fus, size_t num_fus, size_t pipe_length) {
-    // Allocate entry buffers
-    qentry_t *entry;
-    qentry_t *entry_tmp;
+/* complete every load whose line fill arrives this cycle */
+static void service_mshrs(void) {
+    for (size_t i = 0; i < core->NUM_MSHRS; i++) {
+        mshr_t *mshr = &core->mshrs[i];
+        if (!mshr->busy || mshr->fill_cycle > core->cycle) continue;
+        for (qentry_t *entry = mshr->waiters; entry != NULL; entry = entry->mshr_next) {
+            entry->in_mshr = false;
+            complete_entry(entry);
+        }
+        mshr->busy = false;
+        core->mshrs_busy--;
+    }
+}
+
+// Called as a store writes the store buffer. Marks every younger load that
+// has already searched the store buffer for the same address as violated,
+// and teaches the store-set predictor to order them next time. Only loads
+// that fired past an older store can have done so.
+static void check_ordering_violations(procsim_stats_t *stats, const qentry_t *store) {
+    size_t offset = store - core->rob;
+    offset = offset >= core->rob_head ? offset - core->rob_head : offset + core->ROB_ENTRIES - core->rob_head;
+    for (size_t i = offset + 1; i < core->rob_size; i++) {
+        qentry_t *load = &core->rob[rob_index(i)];
+        if (!load->speculated || load->violated || load->exec_cycle == 0 ||
+                load->inst->load_store_addr != store->inst->load_store_addr) {
+            continue;
+        }
+        load->violated = true;
+        stats->memory_violations++;
+        if (core->store_sets != NULL) {
+            store_sets_violation(core->store_sets, load->inst->pc, store->inst->pc);
+        }
+    }
+}
+
+void progress_function_units(procsim_stats_t *stats, fu_t *fus, size_t num_fus, size_t pipe_length) {
     // Loop through all FUs
     for (size_t i = 0; i < num_fus; i++) {
-        queue_t *fu = &(fus[i]);
+        fu_t *fu = &(fus[i]);
         // If the function unit is empty, don't need to progress anything
-        if (fu->head == NULL) {
+        if (fu->size == 0) {
             continue;
         }
         // Progress each entry
-        entry = fu->head;
-        while (entry != NULL) {
+        for (size_t s = 0; s < fu->size; s++) {
+            qentry_t *entry = fu->stages[(fu->head + s) % MUL_STAGES];
             entry->exec_cycle++;
             /******** Special operations for load **********/
             if (entry->inst->opcode == OPCODE_LOAD && entry->exec_cycle == 1) {
                 // Search the store buffer
-                qentry_t *stb_entry = qstb.head;
-                while (stb_entry != NULL) {
-                    if (stb_entry->inst->load_store_addr == entry->inst->load_store_addr) {
-                        entry->store_buffer_hit = true;
+                if (stb_contains(entry->inst->load_store_addr)) {
+                    entry->store_buffer_hit = true;
+                } else {
+                    if (core->prefetcher != NULL) {
+                        prefetch_access(stats, entry);
+                    }
+                    if (dcache_miss(entry) && core->l2 != NULL) {
+                        entry->l2_miss = !shared_l2_read(core->l2, core->l2_core_id,
+                                                         entry->inst->load_store_addr);
                     }
-                    stb_entry = stb_entry->next;
                 }
             }
             /******* Special operations for store ************/
             if (entry->inst->opcode == OPCODE_STORE) {
-                fifo_insert_copy_tail(&qstb, entry);
+                stb_push(entry->inst->load_store_addr);
+                if (core->speculated_loads) {
+                    check_ordering_violations(stats, entry);
+                }
+                if (core->prefetcher != NULL && entry->exec_cycle == 1) {
+                    prefetch_access(stats, entry);
+                }
             }
             /*************************************************/
-            entry = entry->next;
         }
-        // Calculate the deepest entry's finish cycle
-        int complete_cycle = pipe_length;
-        if (fu->head->inst->dcache_miss) {
-            complete_cycle += L1_MISS_PENALTY;
+        qentry_t *head = fu->stages[fu->head];
+        // With MSHRs, a load leaves the LSU at the end of its tag check
+        if (core->NUM_MSHRS && head->inst->opcode == OPCODE_LOAD && !head->store_buffer_hit &&
+                head->exec_cycle == pipe_length && try_enter_mshr(stats, head)) {
+            fu->head = (fu->head + 1) % MUL_STAGES;
+            fu->size--;
+            continue;
         }
+        // Calculate the deepest entry's finish cycle
+        size_t complete_cycle = pipe_length;
         // Special case for store buffer operations
-        if (fu->head->store_buffer_hit || fu->head->inst->opcode == OPCODE_STORE) {
+        if (head->store_buffer_hit || head->inst->opcode == OPCODE_STORE) {
             complete_cycle = 1;  // Finishes immediately
+        } else if (dcache_miss(head)) {
+            complete_cycle += read_miss_penalty(head);
         }
         // If it's completed remove it and update the ROB entry
-        if (fu->head->exec_cycle >= complete_cycle) {
-            int x = 0;
-            if (fu->head->inst->dyn_instruction_count == 26) {
-                x++;
-            }
-            entry = fifo_pop_head(fu);
-            if (entry == NULL) printf("MY ERROR, where did the head go?\n");
-            // Remove from the RS
-            entry_tmp = fifo_search_and_pop(rs, entry->inst->dyn_instruction_count);
-            if (entry_tmp == NULL) {
-                printf("MY ERROR, where did RS entry go?\n");
-            }
-            free(entry_tmp);  // Free the RS entry
-            // Copy over to the ROB entry and mark as completed
-            entry_tmp = search_queue(&qrob, entry->inst->dyn_instruction_count);
-            qentry_copy(entry, entry_tmp);
-            entry_tmp->completed = true;  // Mark ROB entry as completed
-            // Mark preg as ready
-            if (entry->dest_preg >= 0) {
-                reg_file[entry->dest_preg].ready = 1;
-            }
+        if (head->exec_cycle >= complete_cycle) {
+            fu->head = (fu->head + 1) % MUL_STAGES;
+            fu->size--;
+            complete_entry(head);
 
 #ifdef DEBUG
             printf("\tCompleting Instruction: ");
-            print_instruction(entry->inst);
+            print_instruction(head->inst);
             printf("\n");
 #endif
-            free(entry);  // Free the FU entry
         }
     }
 }
@@ -381,70 +787,222 @@ void progress_function_units(queue_t *rs, queue_t *fus, size_t num_fus, size_t p
 // architectural registers, but we have no register values in this
 // simulation.) This function returns the number of instructions retired.
 // Immediately after retiring a mispredicting branch, this function will set
-// *retired_mispredict_out = true and will not retire any more instructions. 
+// *retired_mispredict_out = true and will not retire any more instructions.
 // Note that in this case, the mispredict must be counted as one of the retired instructions.
 
-// This will hold the previous number of completed stores and will be updated
-// every cycle
-int STORES_COMPLETED = 0;
+/* add a retiring instruction's latencies to its opcode's histograms */
+static inline void record_latencies(procsim_stats_t *stats, const qentry_t *entry) {
+    size_t op = entry->inst->opcode - OPCODE_ADD;
+    uint64_t latencies[NUM_LATENCY_KINDS];
+    latencies[LATENCY_QUEUE] = entry->fire_cycle - entry->dispatch_cycle;
+    latencies[LATENCY_EXEC] = entry->complete_cycle - entry->fire_cycle;
+    latencies[LATENCY_ROB] = core->cycle - entry->dispatch_cycle;
+    for (int k = 0; k < NUM_LATENCY_KINDS; k++) {
+        stats->latency_hist[op][k][latency_bucket(latencies[k])]++;
+        if (latencies[k] > stats->latency_max[op][k]) {
+            stats->latency_max[op][k] = latencies[k];
+        }
+    }
+}
+
+// Charges this cycle's retire slots to the CPI stack. Slots without a
+// retiring instruction go to the first cause that applies: an empty ROB is
+// the front end's fault, a load at the head waiting on a D-cache miss is the
+// memory's, then whatever held back dispatch or scheduling last cycle, and
+// otherwise the head is waiting on its operands or its own execution.
+// Retirement is not limited to fetch_width, so instructions that completed
+// behind a stalled head retire in a burst once it completes. Their slots
+// were overlapped with the stall, so a burst takes back stall slots charged
+// earlier, most recent cause first, and retiring counts every instruction.
+static void repay_cpi_slots(procsim_stats_t *stats, uint64_t excess) {
+    for (int i = 0; i < NUM_CPI_CATEGORIES && excess; i++) {
+        int c = (core->cpi_last_cause + i) % NUM_CPI_CATEGORIES;
+        uint64_t take = excess;
+        if (core->cpi_unrepaid[c] < take) take = core->cpi_unrepaid[c];
+        if (stats->cpi_slots[c] < take) take = stats->cpi_slots[c];
+        core->cpi_unrepaid[c] -= take;
+        stats->cpi_slots[c] -= take;
+        stats->cpi_slots[CPI_RETIRING] += take;
+        excess -= take;
+    }
+}
+
+static inline void charge_cpi_slots(procsim_stats_t *stats, uint64_t retired) {
+    uint64_t width = core->FETCH_WIDTH;
+    uint64_t retiring = retired < width ? retired : width;
+    stats->cpi_slots[CPI_RETIRING] += retiring;
+    if (retired > width) {
+        repay_cpi_slots(stats, retired - width);
+    } else if (retiring < width) {
+        cpi_category_t cause;
+        const qentry_t *head = &core->rob[core->rob_head];
+        if (core->rob_size == 0) {
+            cause = core->frontend_cause;
+        } else if (head->in_mshr || (head->fired && head->inst->opcode == OPCODE_LOAD &&
+                                     dcache_miss(head) && !head->store_buffer_hit)) {
+            cause = CPI_DCACHE_MISS;
+        } else if (core->dispatch_stall != CPI_RETIRING) {
+            cause = core->dispatch_stall;
+        } else if (core->schedule_stall != CPI_RETIRING) {
+            cause = core->schedule_stall;
+        } else {
+            cause = CPI_OPERANDS;
+        }
+        stats->cpi_slots[cause] += width - retiring;
+        core->cpi_unrepaid[cause] += width - retiring;
+        core->cpi_last_cause = cause;
+    }
+    core->dispatch_stall = CPI_RETIRING;
+    core->schedule_stall = CPI_RETIRING;
+}
+
+/* add a retiring instruction's stall cycles to its PC's profile entry */
+static void record_hotspot(const qentry_t *entry) {
+    hotspot_entry_t *hot = hotspot_lookup(core->hotspots, entry->inst->pc, entry->inst->opcode);
+    if (hot == NULL) return;
+    hot->retired++;
+    hot->cycles[HOTSPOT_HEAD] += entry->head_cycles;
+    hot->cycles[HOTSPOT_OPERANDS] += entry->ready_cycle - entry->dispatch_cycle;
+    hot->cycles[HOTSPOT_DISAMBIG] += entry->disambig_cycles;
+    if (entry->mshr_merged) {
+        hot->cycles[HOTSPOT_DCACHE_MISS] += entry->complete_cycle - entry->fire_cycle - L1_HIT_TIME;
+    } else if (entry->inst->opcode == OPCODE_LOAD && dcache_miss(entry) && !entry->store_buffer_hit) {
+        hot->cycles[HOTSPOT_DCACHE_MISS] += entry->miss_penalty;
+    }
+}
+
+// Squashes every in-flight instruction, starting with the ROB head, a load
+// that read before an older store to its address wrote it, and has the
+// driver fetch them again. Violations are only acted on once the load is the
+// oldest instruction, so undoing every rename leaves the RAT mapping retired
+// state and the older stores are all done when the load reads again.
+static void squash_pipeline(procsim_stats_t *stats) {
+    stats->memory_squashes++;
+    stats->replayed_instructions += core->rob_size;
+    procsim_driver_refetch(core->rob[core->rob_head].inst);
+    // Undo the renames youngest first
+    for (size_t i = core->rob_size; i-- > 0; ) {
+        const qentry_t *entry = &core->rob[rob_index(i)];
+        if (entry->dest_preg >= 0) {
+            core->RAT[entry->inst->dest] = entry->prev_preg;
+            set_preg_free(entry->dest_preg, true);
+        }
+    }
+    core->rob_size = 0;
+    core->qdisp.size = 0;
+    // Stores write the store buffer in program order, so the ones squashed
+    // are those after the stores retired this cycle
+    while (core->stb_size > (size_t)core->STORES_COMPLETED) {
+        stb_pop_newest();
+    }
+    core->sched_size = 0;
+    for (int l = 0; l < NUM_LINKS; l++) {
+        core->sched_lists[l].head = NULL;
+        core->sched_lists[l].tail = NULL;
+    }
+    core->alu_ready.size = 0;
+    core->mul_ready.size = 0;
+    core->lsu_ready.size = 0;
+    for (size_t i = 0; i < core->NUM_ALU_FUS; i++) core->qalu_fus[i].size = 0;
+    for (size_t i = 0; i < core->NUM_MUL_FUS; i++) core->qmul_fus[i].size = 0;
+    for (size_t i = 0; i < core->NUM_LSU_FUS; i++) core->qlsu_fus[i].size = 0;
+    for (size_t i = 0; i < core->NUM_MSHRS; i++) core->mshrs[i].busy = false;
+    core->mshrs_busy = 0;
+    for (size_t i = 0; i < NUM_REGS + core->NUM_PREGS; i++) {
+        core->preg_waiters[i] = -1;
+    }
+    core->speculated_loads = 0;
+    core->in_mispredict = false;
+    core->redirect_inst = NULL;
+    core->frontend_cause = CPI_STORE_ORDER;
+}
+
 static uint64_t stage_state_update(procsim_stats_t *stats,
                                    bool *retired_mispredict_out) {
     // TODO: fill me in
 #ifdef DEBUG
     printf("Stage Retire: \n"); //  PROVIDED
 #endif
-    qentry_t *entry;  // Variable to hold entries
-
     // Pop as many stores entries as store instructions were retired last cycle
-    for (int i = 0; i < STORES_COMPLETED; i++) {
-        entry = fifo_pop_head(&qstb);
-        if (entry == NULL) printf("MY ERROR, why is the store buffer empty?\n");
-        free(entry);
+    for (int i = 0; i < core->STORES_COMPLETED; i++) {
+        stb_pop();
     }
 
-    STORES_COMPLETED = 0;  // Reset
+    core->STORES_COMPLETED = 0;  // Reset
     int completed = 0;
 
-    while (1) {
-        entry = qrob.head;  // Keep getting the ROB head
-        if (entry == NULL) break;
-        if (entry->completed) {
-            // Store if this instruction was mispredicted
-            bool mispredicted = entry->inst->mispredict;
-            // Free previous preg if it's not an architectural register
-            if (entry->prev_preg >= 32) reg_file[entry->prev_preg].free = true;
-            // Increment counters
-            if (entry->inst->opcode == OPCODE_STORE) STORES_COMPLETED++;
-            completed++;
-            // Remove from the ROB
-            entry = fifo_pop_head(&qrob);
-            if (entry == NULL) printf("MY ERROR, why isn't it in the ROB?\n");
-            // Update read statistics
-            if (entry->inst->opcode == OPCODE_LOAD) {
-                stats->reads++;
-                if (entry->store_buffer_hit) {
-                    stats->store_buffer_read_hits++;
-                } else {
-                    stats->dcache_reads++;
-                    if (entry->inst->dcache_miss) {
-                        stats->dcache_read_misses++;
-                    } else {
-                        stats->dcache_read_hits++;
+    while (core->rob_size != 0) {
+        qentry_t *entry = &core->rob[core->rob_head];  // Keep getting the ROB head
+        if (!entry->completed) {
+            break;  // Stop at the first incomplete entry
+        }
+        if (entry->violated) {
+            squash_pipeline(stats);
+            break;
+        }
+        // Store if this instruction was mispredicted
+        bool mispredicted = entry->inst->mispredict;
+        // Free previous preg if it's not an architectural register
+        if (entry->prev_preg >= 32) set_preg_free(entry->prev_preg, true);
+        // Increment counters
+        if (entry->inst->opcode == OPCODE_STORE) core->STORES_COMPLETED++;
+        completed++;
+        // Update read statistics
+        if (entry->inst->opcode == OPCODE_LOAD) {
+            stats->reads++;
+            if (entry->store_buffer_hit) {
+                stats->store_buffer_read_hits++;
+            } else {
+                stats->dcache_reads++;
+                stats->prefetch_hits += entry->prefetch_hit;
+                stats->prefetch_late_hits += entry->prefetch_late;
+                if (dcache_miss(entry)) {
+                    stats->dcache_read_misses++;
+                    if (core->l2 != NULL) {
+                        stats->l2_reads++;
+                        stats->l2_read_misses += entry->l2_miss;
+                    } else if (entry->mem_read.cycles != 0) {
+                        // Merged reads never got to the L2
+                        stats->l2_reads++;
+                        stats->l2_read_misses += entry->l2_miss;
+                        stats->l2_read_cycles += entry->mem_read.cycles;
+                        stats->l2_queue_cycles += entry->mem_read.l2_queue_cycles;
+                        stats->dram_read_cycles += entry->mem_read.dram_cycles;
+                        stats->dram_queue_cycles += entry->mem_read.dram_queue_cycles;
                     }
+                } else {
+                    stats->dcache_read_hits++;
                 }
             }
-            // Free the ROB entry
-            free(entry);
-            // Stop if this instruction was mispredicted and set sim flag
-            if (mispredicted) {
-                *retired_mispredict_out = true;
-                in_mispredict = false;
-                break;
+            stats->mshr_merged_reads += entry->mshr_merged;
+            if (entry->speculated) {
+                stats->speculative_loads++;
+                core->speculated_loads--;
             }
-        } else {
-            break;  // Stop at the first incomplete entry
+        }
+        if (core->LATENCY_HISTOGRAMS) record_latencies(stats, entry);
+        if (core->hotspots != NULL) record_hotspot(entry);
+        // Remove from the ROB
+        core->rob_head = rob_index(1);
+        core->rob_size--;
+        // With early recovery fetch has already been redirected, and younger
+        // instructions can retire along with the branch
+        if (mispredicted && core->EARLY_RECOVERY) {
+            stats->branch_mispredictions++;
+            continue;
+        }
+        // Stop if this instruction was mispredicted and set sim flag
+        if (mispredicted) {
+            *retired_mispredict_out = true;
+            core->in_mispredict = false;
+            core->frontend_cause = CPI_MISPREDICT;
+            break;
         }
     }
+    charge_cpi_slots(stats, completed);
+    if (core->hotspots != NULL && core->rob_size != 0) {
+        core->rob[core->rob_head].head_cycles++;
+    }
 
     stats->instructions_retired += completed;
     return completed;
@@ -453,7 +1011,7 @@ static uint64_t stage_state_update(procsim_stats_t *stats,
 // Optional helper function which is responsible for moving instructions
 // through pipelined Function Units and then when instructions complete (that
 // is, when instructions are in the final pipeline stage of an FU and aren't
-// stalled there), setting the ready bits in the register file. This function 
+// stalled there), setting the ready bits in the register file. This function
 // should remove an instruction from the scheduling queue when it has completed.
 static void stage_exec(procsim_stats_t *stats) {
     // TODO: fill me in
@@ -465,90 +1023,138 @@ static void stage_exec(procsim_stats_t *stats) {
     printf("Progressing ALU units\n");  // PROVIDED
 #endif
 
-    progress_function_units(&qsched, qalu_fus, NUM_ALU_FUS, 1);
+    progress_function_units(stats, core->qalu_fus, core->NUM_ALU_FUS, ALU_STAGES);
 
 #ifdef DEBUG
     printf("Progressing MUL units\n");  // PROVIDED
 #endif
 
-    progress_function_units(&qsched, qmul_fus, NUM_MUL_FUS, 3);
+    progress_function_units(stats, core->qmul_fus, core->NUM_MUL_FUS, MUL_STAGES);
 
 #ifdef DEBUG
     printf("Progressing LSU units for loads and stores and processing result busses\n");  // PROVIDED
 #endif
 
-    progress_function_units(&qsched, qlsu_fus, NUM_LSU_FUS, L1_HIT_TIME);
+    if (core->mshrs_busy) {
+        service_mshrs();
+    }
+    progress_function_units(stats, core->qlsu_fus, core->NUM_LSU_FUS, L1_HIT_TIME);
 }
 
 // Optional helper function which is responsible for looking through the
 // scheduling queue and firing instructions that have their source pregs
 // marked as ready. Note that when multiple instructions are ready to fire
-// in a given cycle, they must be fired in program order. 
-// Also, load and store instructions must be fired according to the 
+// in a given cycle, they must be fired in program order.
+// Also, load and store instructions must be fired according to the
 // memory disambiguation algorithm described in the assignment PDF. Finally,
 // instructions stay in their reservation station in the scheduling queue until
 // they complete (at which point stage_exec() above should free their RS).
+//
+// Each FU class fires independently, so rather than walking the whole SchedQ
+// every cycle we fire the oldest ready instructions of each class until its
+// FUs are taken.
+// true if the store whose dyn_instruction_count + 1 is id is still in the
+// ROB and has not executed
+static bool store_pending(uint64_t id) {
+    if (id == 0 || core->rob_size == 0) return false;
+    uint64_t head_dyn = core->rob[core->rob_head].inst->dyn_instruction_count;
+    if (id - 1 < head_dyn || id - 1 - head_dyn >= core->rob_size) return false;
+    const qentry_t *store = &core->rob[rob_index(id - 1 - head_dyn)];
+    return store->inst->dyn_instruction_count == id - 1 && !store->completed;
+}
+
+// Fires ready memory ops under a speculative disambiguation policy. Stores
+// still wait for every older load and store, but loads go ahead of older
+// stores that have not executed, unless their store set names one of them.
+// Memory ops that have to wait are set aside so that younger ones can go.
+// Returns true if any fired.
+static bool schedule_speculative(void) {
+    bool fired = false;
+    size_t held = 0;
+    while (core->lsu_ready.size != 0) {
+        qentry_t *entry = core->lsu_ready.items[0];
+        const qentry_t *oldest_store = core->sched_lists[LINK_STORE].head;
+        bool wait;
+        if (entry->inst->opcode == OPCODE_STORE) {
+            const qentry_t *oldest = core->sched_lists[LINK_MEM].head;
+            wait = oldest != entry &&
+                oldest->inst->dyn_instruction_count < entry->inst->dyn_instruction_count;
+        } else {
+            wait = core->DISAMBIG_POLICY == DISAMBIG_STORE_SETS &&
+                store_pending(entry->store_set_wait);
+        }
+        if (wait) {
+            core->schedule_stall = CPI_STORE_ORDER;
+            if (core->hotspots != NULL) entry->disambig_cycles++;
+            heap_pop(&core->lsu_ready);
+            core->lsu_held[held++] = entry;
+            continue;
+        }
+        if (try_fire(core->qlsu_fus, core->NUM_LSU_FUS, &core->lsu_ready) != 0) {
+            core->schedule_stall = CPI_FU_BUSY;
+            break;
+        }
+        fired = true;
+        if (entry->inst->opcode == OPCODE_LOAD && oldest_store != NULL &&
+                oldest_store->inst->dyn_instruction_count < entry->inst->dyn_instruction_count) {
+            entry->speculated = true;
+            core->speculated_loads++;
+        }
+    }
+    for (size_t i = 0; i < held; i++) {
+        heap_push(&core->lsu_ready, core->lsu_held[i]);
+    }
+    return fired;
+}
+
 static void stage_schedule(procsim_stats_t *stats) {
     // TODO: fill me in
 #ifdef DEBUG
     printf("Stage Schedule: \n"); //  PROVIDED
 #endif
-    qentry_t *entry;
-    int success;
-    int ok_to_fire;
     int fired_this_cycle = false;
-    qentry_t *preceding_op_entry;
-
-    // Schedule
-    entry = qsched.head;
-    while (entry != NULL) {
-        if (!entry->fired) {
-            ok_to_fire = true;
-            success = -1;
-            switch (entry->inst->opcode) {
-                case OPCODE_BRANCH:
-                case OPCODE_ADD:
-                    success = try_fire(qalu_fus, NUM_ALU_FUS, entry);
-                    break;
-                case OPCODE_MUL:
-                    success = try_fire(qmul_fus, NUM_MUL_FUS, entry);
-                    break;
-                case OPCODE_LOAD:
-                case OPCODE_STORE:
-                    /************* Memory Disambiguation Logic *************/
-                    preceding_op_entry = qsched.head;
-                    // Check from the start of the schedule queue up to this instruction
-                    // if there are any load/stores
-                    while (preceding_op_entry != entry) {
-                        if (!preceding_op_entry->completed) {
-                            if (preceding_op_entry->inst->opcode == OPCODE_STORE) {
-                                ok_to_fire = false;
-                            }
-                            if (preceding_op_entry->inst->opcode == OPCODE_LOAD) {
-                                if (entry->inst->opcode == OPCODE_STORE) {
-                                    ok_to_fire = false;
-                                }
-                            }
-                        }
-                        preceding_op_entry = preceding_op_entry->next;
-                    }
-                    /*******************************************************/
-                    if (ok_to_fire) {
-                        success = try_fire(qlsu_fus, NUM_LSU_FUS, entry);
-                    } else {
-                        success = -1;
-                    }
-                    break;
-                default:
-                    break;
-            }
-            if (success == 0) {
-                entry->fired = true;
-                fired_this_cycle = true;
+    int ret;
+
+    while ((ret = try_fire(core->qalu_fus, core->NUM_ALU_FUS, &core->alu_ready)) == 0) {
+        fired_this_cycle = true;
+    }
+    if (ret == -2) core->schedule_stall = CPI_FU_BUSY;
+    while ((ret = try_fire(core->qmul_fus, core->NUM_MUL_FUS, &core->mul_ready)) == 0) {
+        fired_this_cycle = true;
+    }
+    if (ret == -2) core->schedule_stall = CPI_FU_BUSY;
+
+    /************* Memory Disambiguation Logic *************/
+    // A load may not fire past an older store still in the schedule queue,
+    // and a store may not fire past any older load or store. Once the oldest
+    // ready memory op is held back, every younger one is too.
+    if (core->DISAMBIG_POLICY != DISAMBIG_CONSERVATIVE && schedule_speculative()) {
+        fired_this_cycle = true;
+    }
+    while (core->DISAMBIG_POLICY == DISAMBIG_CONSERVATIVE && core->lsu_ready.size != 0) {
+        const qentry_t *entry = core->lsu_ready.items[0];
+        const qentry_t *oldest = entry->inst->opcode == OPCODE_STORE
+            ? core->sched_lists[LINK_MEM].head
+            : core->sched_lists[LINK_STORE].head;
+        if (oldest != NULL && oldest != entry &&
+                oldest->inst->dyn_instruction_count < entry->inst->dyn_instruction_count) {
+            core->schedule_stall = CPI_STORE_ORDER;
+            if (core->hotspots != NULL) {
+                // Every younger ready memory op is held back with it
+                for (size_t i = 0; i < core->lsu_ready.size; i++) {
+                    core->lsu_ready.items[i]->disambig_cycles++;
+                }
             }
+            break;
+        }
+        if (try_fire(core->qlsu_fus, core->NUM_LSU_FUS, &core->lsu_ready) != 0) {
+            core->schedule_stall = CPI_FU_BUSY;
+            break;
         }
-        entry = entry->next;
+        fired_this_cycle = true;
     }
+    /*******************************************************/
+
     if (!fired_this_cycle) {
         stats->no_fire_cycles++;
     }
@@ -557,9 +1163,9 @@ static void stage_schedule(procsim_stats_t *stats) {
 // Optional helper function which looks through the dispatch queue, decodes
 // instructions, and inserts them into the scheduling queue. Dispatch should
 // not add an instruction to the scheduling queue unless there is space for it
-// in the scheduling queue and the ROB and a free preg exists if necessary; 
-// effectively, dispatch allocates pregs, reservation stations and ROB space for 
-// each instruction dispatched and stalls if there any are unavailable. 
+// in the scheduling queue and the ROB and a free preg exists if necessary;
+// effectively, dispatch allocates pregs, reservation stations and ROB space for
+// each instruction dispatched and stalls if there any are unavailable.
 // You will also need to update the RAT if need be.
 // Note the scheduling queue has a configurable size and the ROB has P+32 entries.
 // The PDF has details.
@@ -568,89 +1174,109 @@ static void stage_dispatch(procsim_stats_t *stats) {
 #ifdef DEBUG
     printf("Stage Dispatch: \n"); //  PROVIDED
 #endif
-    qentry_t *entry = qdisp.head;  // Start at dispatch queue head
-    if (stats->cycles == 33) {
-        int x = 0; x++;
-    }
     while (1) {
-        entry = qdisp.head;  // Keep getting dispatch head
-        if (entry == NULL) {
+        const inst_t *inst = inst_ring_head(&core->qdisp);  // Keep getting dispatch head
+        if (inst == NULL) {
             break;
         }
 #ifdef DEBUG
         printf("\tAttempting Dispatch for: ");
-        print_instruction(entry->inst);
+        print_instruction(inst);
         printf("\n");
 #endif
 
         // Don't commit any changes to queues until all conditions satisfied
 
-        const inst_t *inst = entry->inst;  // Used frequently
-
         // Check if the ROB has room
-        if (qrob.size >= qrob.max_size) {
+        if (core->rob_size >= core->ROB_ENTRIES) {
             stats->rob_stall_cycles++;
+            core->dispatch_stall = CPI_ROB_FULL;
             return;
         }
 
         // Check if the schedule queue has room
-        if (qsched.size >= qsched.max_size) {
+        if (core->sched_size >= core->SCHED_ENTRIES) {
+            core->dispatch_stall = CPI_SCHEDQ_FULL;
             return;
         }
 
         // Search for a free preg
         int dest_preg_num = -1;
         if (inst->dest >= 0) {
-            for (size_t i = 32; i < 32 + NUM_PREGS; i++) {
-                if (reg_file[i].free) {
-                    dest_preg_num = i;
-                    break;
-                }
-            }
+            dest_preg_num = find_free_preg();
             if (dest_preg_num < 0) {
                 stats->no_dispatch_pregs_cycles++;
+                core->dispatch_stall = CPI_PREGS;
                 return;  // No free pregs
             }
         }
 
         // Now queue changes will be committed
 
-        int success = fifo_insert_tail(&qsched, fifo_pop_head(&qdisp));
-        if (success != 0) {
-            printf("MY ERROR, why was the schedule queue full?\n");
-            return;
-        }
+        inst_ring_pop(&core->qdisp);
+
+        // Allocate an entry in the ROB
+        qentry_t *entry = &core->rob[rob_index(core->rob_size)];
+        core->rob_size++;
+        memset(entry, 0, sizeof *entry);
+        entry->inst = inst;
+        entry->dispatch_cycle = core->cycle;
 
         // Set physical registers in entry
         if (inst->src1 >= 0) {
-            entry->src1_preg = RAT[inst->src1];
+            entry->src1_preg = core->RAT[inst->src1];
         } else {
             entry->src1_preg = -1;
         }
 
         if (inst->src2 >= 0) {
-            entry->src2_preg = RAT[inst->src2];
+            entry->src2_preg = core->RAT[inst->src2];
         } else {
             entry->src2_preg = -1;
         }
 
         if (inst->dest >= 0) {
-            entry->prev_preg = RAT[inst->dest];  // Save previous preg
+            entry->prev_preg = core->RAT[inst->dest];  // Save previous preg
             entry->dest_preg = dest_preg_num;
-            RAT[inst->dest] = dest_preg_num;
-            reg_file[dest_preg_num].free = false;
-            reg_file[dest_preg_num].ready = false;
+            core->RAT[inst->dest] = dest_preg_num;
+            set_preg_free(dest_preg_num, false);
+            core->reg_file[dest_preg_num].ready = false;
         } else {
             entry->dest_preg = -1;
         }
 
-        // Allocate an entry in the ROB
-        qentry_t *rob_entry = (qentry_t *)malloc(sizeof(qentry_t));
-        qentry_copy(entry, rob_entry);
-        success = fifo_insert_tail(&qrob, rob_entry);
-        if (success != 0) {
-            printf("MY ERROR, why was the ROB full?\n");
-            return;
+        // Insert into the schedule queue, waiting for any sources that
+        // aren't ready yet
+        core->sched_size++;
+        if (inst->opcode == OPCODE_LOAD || inst->opcode == OPCODE_STORE) {
+            qlist_append(&core->sched_lists[LINK_MEM], entry, LINK_MEM);
+        }
+        if (inst->opcode == OPCODE_STORE) {
+            qlist_append(&core->sched_lists[LINK_STORE], entry, LINK_STORE);
+        }
+        if (core->store_sets != NULL &&
+                (inst->opcode == OPCODE_LOAD || inst->opcode == OPCODE_STORE)) {
+            uint32_t set = store_sets_lookup(core->store_sets, inst->pc);
+            if (set != STORE_SET_NONE) {
+                if (inst->opcode == OPCODE_LOAD) {
+                    // After a squash the set's last store may be a younger
+                    // one that was squashed and has not been fetched again
+                    uint64_t last = store_sets_last_store(core->store_sets, set);
+                    if (last <= inst->dyn_instruction_count) entry->store_set_wait = last;
+                } else {
+                    store_sets_set_last_store(core->store_sets, set, inst->dyn_instruction_count);
+                }
+            }
+        }
+        if (entry->src1_preg >= 0 && !core->reg_file[entry->src1_preg].ready) {
+            wait_on_preg(entry, entry->src1_preg, 0);
+        }
+        if (entry->src2_preg >= 0 && !core->reg_file[entry->src2_preg].ready) {
+            wait_on_preg(entry, entry->src2_preg, 1);
+        }
+        if (entry->pending_srcs == 0) {
+            entry->ready_cycle = core->cycle;
+            heap_push(ready_heap_for(entry), entry);
         }
 #ifdef DEBUG
         printf("\t\tDispatching instruction\n");
@@ -658,99 +1284,153 @@ static void stage_dispatch(procsim_stats_t *stats) {
     }
 }
 
-bool in_icache_miss_local = false;
 // Optional helper function which fetches instructions from the instruction
-// cache using the provided procsim_driver_read_inst() function implemented
-// in the driver and appends them to the dispatch queue. To simplify the
-// project, the dispatch queue is infinite in size.
+// cache using the provided procsim_driver_read_insts() function implemented
+// in the driver and appends them to the dispatch queue. The dispatch queue is
+// infinite in size unless a capacity is configured, in which case fetch
+// stalls while it is full.
 static void stage_fetch(procsim_stats_t *stats) {
 #ifdef DEBUG
     printf("Stage Fetch: \n"); //  PROVIDED
 #endif
-    // Fetch instructions and add them to the dispatch queue
-    for (size_t i = 0; i < FETCH_WIDTH; i++) {
-        const inst_t *inst = procsim_driver_read_inst();
-        if (inst == NULL) {
-            if (!in_mispredict) {
-                in_icache_miss_local = true;
-            }
-            return;
-        }
-        // New instruction fetched
-        if (in_icache_miss_local) {
+    if (core->redirect_inst != NULL && core->cycle >= core->redirect_cycle) {
+        procsim_driver_refetch(core->redirect_inst);
+        core->redirect_inst = NULL;
+        core->in_mispredict = false;
+    }
+    if (core->in_mispredict) {
+        stats->mispredict_recovery_cycles++;
+    }
+    // Fetch a span of instructions and add them to the dispatch queue. Only
+    // its last instruction can be a mispredict, since fetch stops there
+    size_t want = core->FETCH_WIDTH;
+    if (core->DISPQ_ENTRIES && core->DISPQ_ENTRIES - core->qdisp.size < want) {
+        want = core->DISPQ_ENTRIES - core->qdisp.size;
+    }
+    const inst_t *insts = NULL;
+    size_t n = want ? procsim_driver_read_insts(want, &insts) : 0;
+    if (n) {
+        // New instructions fetched
+        if (core->in_icache_miss_local) {
             stats->icache_misses++;
-            in_icache_miss_local = false;
+            core->in_icache_miss_local = false;
         }
-        qentry_t *entry = (qentry_t *)calloc(1, sizeof(qentry_t));
-        entry->inst = inst;
-        int success = fifo_insert_tail(&qdisp, entry);
-        if (success != 0) {
+        if (inst_ring_push_span(&core->qdisp, insts, n) != 0) {
             printf("MY ERROR, why couldn't we add to the dispatch queue?\n");
         }
-        if (inst->mispredict) {
-            in_mispredict = true;
+        if (insts[n - 1].mispredict) {
+            core->in_mispredict = true;
         }
 #ifdef DEBUG
-        printf("Fetched Instruction: ");
-        print_instruction(entry->inst);
-        printf("\n");
+        for (size_t i = 0; i < n; i++) {
+            printf("Fetched Instruction: ");
+            print_instruction(&insts[i]);
+            printf("\n");
+        }
 #endif
-        stats->instructions_fetched++;
+        stats->instructions_fetched += n;
+    }
+    if (n < want) {
+        // The front end has nothing more this cycle
+        if (!core->in_mispredict) {
+            core->in_icache_miss_local = true;
+            core->frontend_cause = CPI_ICACHE_MISS;
+        }
+    } else if (want < core->FETCH_WIDTH) {
+        stats->dispq_full_cycles++;
     }
 }
 
+/* allocate and initialize the FU pipes of one class */
+static fu_t *fus_init(size_t num_fus, size_t max_size) {
+    fu_t *fus = (fu_t *)calloc(num_fus, sizeof(fu_t));
+    for (size_t i = 0; i < num_fus; i++) {
+        fus[i].max_size = max_size;
+    }
+    return fus;
+}
+
 // Use this function to initialize all your data structures, simulator
 // state, and statistics.
+// Each call creates a new core and makes it the calling thread's current core.
 void procsim_init(const procsim_conf_t *sim_conf, procsim_stats_t *stats) {
-    FETCH_WIDTH = sim_conf->fetch_width;
-    NUM_PREGS = sim_conf->num_pregs;
-    size_t max_rob_entries = 32 + NUM_PREGS;
-
-    NUM_ALU_FUS = sim_conf->num_alu_fus;
-    NUM_MUL_FUS = sim_conf->num_mul_fus;
-    NUM_LSU_FUS = sim_conf->num_lsu_fus;
-
-    queue_init(&qdisp, -1);
-    queue_init(&qsched, sim_conf->num_schedq_entries_per_fu * (NUM_ALU_FUS + NUM_MUL_FUS + NUM_LSU_FUS));
-    queue_init(&qrob, max_rob_entries);
+    core = (procsim_core_t *)calloc(1, sizeof(procsim_core_t));
+    core->FETCH_WIDTH = sim_conf->fetch_width;
+    core->NUM_PREGS = sim_conf->num_pregs;
+    core->LATENCY_HISTOGRAMS = sim_conf->latency_histograms;
+    // A cold pipeline waits on fetch like after an I-cache miss
+    core->frontend_cause = CPI_ICACHE_MISS;
+    core->ROB_ENTRIES = sim_conf->num_rob_entries;
+
+    core->NUM_ALU_FUS = sim_conf->num_alu_fus;
+    core->NUM_MUL_FUS = sim_conf->num_mul_fus;
+    core->NUM_LSU_FUS = sim_conf->num_lsu_fus;
+    core->SCHED_ENTRIES = sim_conf->num_schedq_entries_per_fu * (core->NUM_ALU_FUS + core->NUM_MUL_FUS + core->NUM_LSU_FUS);
+
+    // A bounded dispatch queue is allocated up front and never grows
+    core->DISPQ_ENTRIES = sim_conf->num_dispq_entries;
+    if (core->DISPQ_ENTRIES) {
+        size_t cap = 1;
+        while (cap < core->DISPQ_ENTRIES) cap *= 2;
+        core->qdisp.buf = (const inst_t **)malloc(cap * sizeof(const inst_t *));
+        core->qdisp.cap = cap;
+    }
+    core->rob = (qentry_t *)calloc(core->ROB_ENTRIES, sizeof(qentry_t));
+    core->alu_ready.items = (qentry_t **)calloc(core->SCHED_ENTRIES, sizeof(qentry_t *));
+    core->mul_ready.items = (qentry_t **)calloc(core->SCHED_ENTRIES, sizeof(qentry_t *));
+    core->lsu_ready.items = (qentry_t **)calloc(core->SCHED_ENTRIES, sizeof(qentry_t *));
 
     // Initialize FU pipe queues
-    qalu_fus = (queue_t *)calloc(NUM_ALU_FUS, sizeof(queue_t));
-    for (size_t i = 0; i < NUM_ALU_FUS; i++) {
-        queue_init(&(qalu_fus[i]), 1);  // 1 stage pipe
+    core->qalu_fus = fus_init(core->NUM_ALU_FUS, 1);  // 1 stage pipe
+    core->qmul_fus = fus_init(core->NUM_MUL_FUS, 3);  // 3 stage pipe
+    core->qlsu_fus = fus_init(core->NUM_LSU_FUS, 1);  // 1 stage pipe
+    core->NUM_MSHRS = sim_conf->num_mshrs;
+    core->mshrs = (mshr_t *)calloc(core->NUM_MSHRS ? core->NUM_MSHRS : 1, sizeof(mshr_t));
+    if (sim_conf->l2_size_kib) {
+        core->memory = memory_create(sim_conf);
     }
-
-    qmul_fus = (queue_t *)calloc(NUM_MUL_FUS, sizeof(queue_t));
-    for (size_t i = 0; i < NUM_MUL_FUS; i++) {
-        queue_init(&(qmul_fus[i]), 3);  // 3 stage pipe
+    size_t degree = sim_conf->prefetch_degree ? sim_conf->prefetch_degree : PREFETCH_DEFAULT_DEGREE;
+    core->prefetcher = prefetch_create(sim_conf->prefetcher,
+                                       degree < PREFETCH_MAX_DEGREE ? degree : PREFETCH_MAX_DEGREE);
+    core->DISAMBIG_POLICY = sim_conf->disambig_policy;
+    core->EARLY_RECOVERY = sim_conf->early_recovery;
+    core->REDIRECT_PENALTY = sim_conf->redirect_penalty;
+    if (core->DISAMBIG_POLICY == DISAMBIG_STORE_SETS) {
+        core->store_sets = store_sets_create();
     }
+    core->lsu_held = (qentry_t **)calloc(core->SCHED_ENTRIES, sizeof(qentry_t *));
 
-    qlsu_fus = (queue_t *)calloc(NUM_LSU_FUS, sizeof(queue_t));
-    for (size_t i = 0; i < NUM_LSU_FUS; i++) {
-        queue_init(&(qlsu_fus[i]), 1);  // 1 stage pipe
-    }
-
-    // Initialize store buffer
-    queue_init(&qstb, max_rob_entries);
+    // Initialize store buffer, which never holds more stores than the ROB.
+    // The hash table is kept at most half full
+    core->stb_addrs = (uint64_t *)calloc(core->ROB_ENTRIES, sizeof(uint64_t));
+    size_t stb_table_size = 1;
+    while (stb_table_size < 2 * core->ROB_ENTRIES) stb_table_size *= 2;
+    core->stb_table = (stb_slot_t *)calloc(stb_table_size, sizeof(stb_slot_t));
+    core->STB_TABLE_MASK = stb_table_size - 1;
 
     // Initialize the register file
-    reg_file = (reg_t *)malloc(sizeof(reg_t) * (32 + sim_conf->num_pregs));
+    core->reg_file = (reg_t *)malloc(sizeof(reg_t) * (32 + sim_conf->num_pregs));
+    core->free_preg_bits = (uint64_t *)calloc((32 + sim_conf->num_pregs + 63) / 64, sizeof(uint64_t));
+    core->preg_waiters = (int32_t *)malloc(sizeof(int32_t) * (32 + sim_conf->num_pregs));
     for (uint32_t i = 0; i < 32; i++) {
-        reg_file[i].free = 0;
-        reg_file[i].ready = 1;
+        core->reg_file[i].free = 0;
+        core->reg_file[i].ready = 1;
     }
     for (uint32_t i = 32; i < 32 + sim_conf->num_pregs; i++) {
-        reg_file[i].free = 1;
-        reg_file[i].ready = 0;
+        set_preg_free(i, true);
+        core->reg_file[i].ready = 0;
+    }
+    for (uint32_t i = 0; i < 32 + sim_conf->num_pregs; i++) {
+        core->preg_waiters[i] = -1;
     }
 
     // Initialize RAT with respective architectural reg number
     for (int i = 0; i < 32; i++) {
-        RAT[i] = i;
+        core->RAT[i] = i;
     }
 
 #ifdef DEBUG
-    printf("\nScheduling queue capacity: %lu instructions\n", sim_conf->num_schedq_entries_per_fu * 
+    printf("\nScheduling queue capacity: %lu instructions\n", sim_conf->num_schedq_entries_per_fu *
             (sim_conf->num_alu_fus + sim_conf->num_mul_fus + sim_conf->num_lsu_fus)); // TODO: Fix ME
     printf("Initial RAT state:\n"); //  PROVIDED
     print_rat();
@@ -780,6 +1460,8 @@ uint64_t procsim_do_cycle(procsim_stats_t *stats,
 
         // After we retire a misprediction, the other stages don't need to run
         stats->branch_mispredictions++;
+        // and fetch only restarts next cycle
+        stats->mispredict_recovery_cycles++;
     } else {
 #ifdef DEBUG
         printf("%" PRIu64 " instructions retired. Did not retire mispredict, so proceeding with other pipeline stages.\n", retired_this_cycle); //  PROVIDED
@@ -794,9 +1476,9 @@ uint64_t procsim_do_cycle(procsim_stats_t *stats,
     }
 
 #ifdef DEBUG
-    printf("End-of-cycle dispatch queue usage: %lu\n", qdisp.size); // TODO: Fix Me
-    printf("End-of-cycle sched queue usage: %lu\n", qsched.size); // TODO: Fix Me
-    printf("End-of-cycle ROB usage: %lu\n", qrob.size); // TODO: Fix Me
+    printf("End-of-cycle dispatch queue usage: %lu\n", core->qdisp.size); // TODO: Fix Me
+    printf("End-of-cycle sched queue usage: %lu\n", core->sched_size); // TODO: Fix Me
+    printf("End-of-cycle ROB usage: %lu\n", core->rob_size); // TODO: Fix Me
     printf("End-of-cycle RAT state:\n"); //  PROVIDED
     print_rat();
     printf("End-of-cycle Physical Register File state:\n"); //  PROVIDED
@@ -809,28 +1491,28 @@ uint64_t procsim_do_cycle(procsim_stats_t *stats,
 
     // TODO: Increment max_usages and avg_usages in stats here!
     stats->cycles++;
-    if (qdisp.size >= stats->dispq_max_size) {
-        stats->dispq_max_size = qdisp.size;
+    core->cycle++;
+    if (core->qdisp.size >= stats->dispq_max_size) {
+        stats->dispq_max_size = core->qdisp.size;
     }
-    if (qsched.size >= stats->schedq_max_size) {
-        stats->schedq_max_size = qsched.size;
+    if (core->sched_size >= stats->schedq_max_size) {
+        stats->schedq_max_size = core->sched_size;
     }
-    if (qrob.size >= stats->rob_max_size) {
-        stats->rob_max_size = qrob.size;
+    if (core->rob_size >= stats->rob_max_size) {
+        stats->rob_max_size = core->rob_size;
     }
-    stats->dispq_avg_size += qdisp.size;
-    stats->schedq_avg_size += qsched.size;
-    stats->rob_avg_size += qrob.size;
+    stats->dispq_avg_size += core->qdisp.size;
+    stats->schedq_avg_size += core->sched_size;
+    stats->rob_avg_size += core->rob_size;
 
     // Return the number of instructions we retired this cycle (including the
     // interrupt we retired, if there was one!)
     return retired_this_cycle;
 }
 
-// Use this function to free any memory allocated for your simulator and to
-// calculate some final statistics.
-void procsim_finish(procsim_stats_t *stats) {
-    // TODO: fill me in
+// Turns the summed usages into averages and computes the ratios. Split out of
+// procsim_finish() so that stats summed over several runs can be finalized.
+void procsim_finalize_stats(procsim_stats_t *stats) {
     stats->dispq_avg_size = (double)stats->dispq_avg_size / stats->cycles;
 
     stats->schedq_avg_size = (double)stats->schedq_avg_size / stats->cycles;
@@ -845,15 +1527,163 @@ void procsim_finish(procsim_stats_t *stats) {
 
     stats->dcache_ratio = (double)stats->dcache_reads / stats->reads;
 
-    stats->dcache_read_aat = L1_HIT_TIME + stats->dcache_read_miss_ratio * L1_MISS_PENALTY;
+    // The private L2 replaces the fixed miss penalty by the measured one
+    double miss_penalty = L1_MISS_PENALTY;
+    if (stats->l2_read_cycles) {
+        stats->l2_read_aat = (double)stats->l2_read_cycles / stats->l2_reads;
+        stats->dram_read_aat = stats->l2_read_misses ?
+            (double)stats->dram_read_cycles / stats->l2_read_misses : 0;
+        miss_penalty = stats->l2_read_aat;
+    }
+    stats->dcache_read_aat = L1_HIT_TIME + stats->dcache_read_miss_ratio * miss_penalty;
 
     stats->read_aat = stats->store_buffer_hit_ratio * 1 +
         stats->dcache_ratio * stats->dcache_read_aat;
 
     stats->ipc = (double)stats->instructions_retired / stats->cycles;
+}
 
-    free(reg_file);
-    free(qalu_fus);
-    free(qmul_fus);
-    free(qlsu_fus);
+// Use this function to free any memory allocated for your simulator and to
+// calculate some final statistics.
+void procsim_finish(procsim_stats_t *stats) {
+    // TODO: fill me in
+    procsim_finalize_stats(stats);
+
+    free(core->qdisp.buf);
+    free(core->rob);
+    free(core->alu_ready.items);
+    free(core->mul_ready.items);
+    free(core->lsu_ready.items);
+    free(core->stb_addrs);
+    free(core->stb_table);
+    free(core->reg_file);
+    free(core->free_preg_bits);
+    free(core->preg_waiters);
+    free(core->qalu_fus);
+    free(core->qmul_fus);
+    free(core->qlsu_fus);
+    free(core->mshrs);
+    memory_destroy(core->memory);
+    prefetch_destroy(core->prefetcher);
+    if (core->store_sets != NULL) store_sets_destroy(core->store_sets);
+    free(core->lsu_held);
+    free(core);
+    core = NULL;
+}
+
+procsim_core_t *procsim_current_core(void) {
+    return core;
+}
+
+void procsim_select_core(procsim_core_t *next) {
+    core = next;
+}
+
+void procsim_attach_shared_l2(shared_l2_t *l2, size_t core_id) {
+    core->l2 = l2;
+    core->l2_core_id = core_id;
+}
+
+uint64_t procsim_watchdog_allowance(void) {
+    // Nothing retires while fetch waits out a mispredict's redirect
+    uint64_t allowance = core->EARLY_RECOVERY ? core->REDIRECT_PENALTY : 0;
+    // Fixed-latency misses, even through a shared L2, fit inside the limit
+    if (core->memory == NULL) return allowance;
+    // Every other in-flight load can be queued ahead of the miss
+    return allowance + memory_max_read_cycles(core->memory, core->ROB_ENTRIES);
+}
+
+void procsim_attach_hotspots(hotspot_table_t *hotspots) {
+    core->hotspots = hotspots;
+}
+
+/* fold v into a state signature */
+static inline uint64_t signature_add(uint64_t sig, uint64_t v) {
+    return fnv1a64(&v, sizeof v, sig);
+}
+
+uint64_t procsim_state_signature(const inst_t *head) {
+    uint64_t sig = FNV1A64_INIT;
+    sig = signature_add(sig, core->rob_size);
+    sig = signature_add(sig, core->qdisp.size);
+    sig = signature_add(sig, core->sched_size);
+    sig = signature_add(sig, core->stb_size);
+    sig = signature_add(sig, core->STORES_COMPLETED);
+    sig = signature_add(sig, core->in_mispredict);
+    if (core->redirect_inst != NULL) {
+        sig = signature_add(sig, core->redirect_inst - head);
+        sig = signature_add(sig, core->redirect_cycle - core->cycle);
+    }
+    sig = signature_add(sig, core->frontend_cause);
+    sig = signature_add(sig, core->cpi_last_cause);
+    // Which pregs are free does not matter to timing, only how many
+    size_t num_free = 0;
+    for (size_t w = 0; w < (NUM_REGS + core->NUM_PREGS + 63) / 64; w++) {
+        num_free += __builtin_popcountll(core->free_preg_bits[w]);
+    }
+    sig = signature_add(sig, num_free);
+    for (size_t i = 0; i < core->rob_size; i++) {
+        const qentry_t *entry = &core->rob[rob_index(i)];
+        sig = signature_add(sig, entry->inst - head);
+        sig = signature_add(sig, (uint64_t)entry->fired << 40 | (uint64_t)entry->completed << 32 |
+                                 (uint64_t)entry->pending_srcs << 24 | entry->store_buffer_hit);
+        sig = signature_add(sig, entry->exec_cycle);
+    }
+    const fu_t *fu_classes[] = {core->qalu_fus, core->qmul_fus, core->qlsu_fus};
+    const size_t num_fus[] = {core->NUM_ALU_FUS, core->NUM_MUL_FUS, core->NUM_LSU_FUS};
+    for (size_t c = 0; c < 3; c++) {
+        for (size_t i = 0; i < num_fus[c]; i++) {
+            const fu_t *fu = &fu_classes[c][i];
+            sig = signature_add(sig, fu->size);
+            for (size_t j = 0; j < fu->size; j++) {
+                sig = signature_add(sig, fu->stages[(fu->head + j) % MUL_STAGES]->inst - head);
+            }
+        }
+    }
+    return sig;
+}
+
+void procsim_advance_trace(size_t insts, const inst_t *head) {
+    if (core->redirect_inst != NULL) {
+        core->redirect_inst += insts;
+    }
+    for (size_t i = 0; i < core->rob_size; i++) {
+        core->rob[rob_index(i)].inst += insts;
+    }
+    for (size_t i = 0; i < core->qdisp.size; i++) {
+        core->qdisp.buf[(core->qdisp.head + i) & (core->qdisp.cap - 1)] += insts;
+    }
+    // Stores complete in program order, so the store buffer holds the
+    // youngest completed stores, the oldest of which may have retired.
+    // Refill it with the addresses of the stores that took their places
+    size_t n = core->stb_size;
+    if (n == 0) return;
+    uint64_t *addrs = (uint64_t *)malloc(n * sizeof(uint64_t));
+    if (addrs == NULL) return;
+    const inst_t *inst = head + core->rob_size;
+    size_t found = 0;
+    while (found < n) {
+        inst--;
+        if (inst->opcode != OPCODE_STORE) continue;
+        if (inst >= head && !core->rob[rob_index(inst - head)].completed) continue;
+        addrs[n - 1 - found++] = inst->load_store_addr;
+    }
+    while (core->stb_size) stb_pop();
+    core->stb_head = 0;
+    for (size_t i = 0; i < n; i++) stb_push(addrs[i]);
+    free(addrs);
+}
+
+void procsim_snapshot(procsim_snapshot_t *snap) {
+    snap->dispq_size = core->qdisp.size;
+    snap->schedq_size = core->sched_size;
+    snap->rob_size = core->rob_size;
+    snap->stb_size = core->stb_size;
+    for (int i = 0; i < NUM_REGS; i++) {
+        snap->rat[i] = core->RAT[i];
+    }
+    for (size_t i = 0; i < NUM_REGS + core->NUM_PREGS; i++) {
+        snap->ready[i] = core->reg_file[i].ready;
+        snap->free[i] = core->reg_file[i].free;
+    }
 }
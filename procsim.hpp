@@ -2,12 +2,33 @@
 #define PROCSIM_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bpred.hpp"
+#include "cache.hpp"
+#include "prefetch.hpp"
+#include "storeset.hpp"
+
+// Bump whenever a change alters simulated results, which invalidates every
+// cached result (see result_cache.hpp)
+#define PROCSIM_MODEL_VERSION 1
 
 // Number of architectural registers / GPRs
 #define NUM_REGS 32
 
 #define L1_MISS_PENALTY 10
 #define L1_HIT_TIME 2
+// Added to L1_MISS_PENALTY when a D-cache miss also misses the shared L2
+#define L2_MISS_PENALTY 50
+
+// Cycles from a mispredicted branch's completion until the correct path is
+// fetched, with early recovery
+#define DEFAULT_REDIRECT_PENALTY 1
+#define MAX_REDIRECT_PENALTY 1000
+
+// Largest bounded DispQ, which is allocated up front
+#define MAX_DISPQ_ENTRIES 65536
 
 #define ALU_STAGES 1
 #define MUL_STAGES 3
@@ -49,8 +70,45 @@ typedef struct {
     // trace/driver sets this flag for you. This bit should be passed through the
     // pipeline all the way to the State Update stage.
     bool dcache_miss;
+    // Instructions from this one on before the next I-cache miss or
+    // mispredict (0 if this is one), capped at UINT32_MAX. The driver sets
+    // this for you, so that it can fetch a span of instructions at once
+    uint32_t fetch_run;
 } inst_t;
 
+// Latency histograms, one per opcode and latency kind, with log-scale
+// buckets: values below LATENCY_EXACT_LIMIT get their own bucket, and each
+// power of two above that is split into LATENCY_SUB_BUCKETS buckets, so a
+// bucket is never wider than 1/LATENCY_SUB_BUCKETS of its values
+#define LATENCY_BUCKETS 64
+#define LATENCY_EXACT_LIMIT 8
+#define LATENCY_SUB_BUCKETS 4
+#define NUM_OPCODES (OPCODE_BRANCH - OPCODE_ADD + 1)
+
+typedef enum {
+    LATENCY_QUEUE,  // Dispatch to fire
+    LATENCY_EXEC,   // Fire to complete
+    LATENCY_ROB,    // Dispatch to retire
+    NUM_LATENCY_KINDS,
+} latency_kind_t;
+
+// Categories of the CPI stack. Every cycle has fetch_width retire slots, and
+// each slot is charged to exactly one category: retiring if an instruction
+// retired in it, otherwise the reason retirement could not keep up
+typedef enum {
+    CPI_RETIRING,
+    CPI_ICACHE_MISS,        // Nothing in the ROB while fetch was stalled or refilling
+    CPI_MISPREDICT,         // Nothing in the ROB after a mispredicted branch
+    CPI_ROB_FULL,           // Dispatch was held back by these three
+    CPI_PREGS,
+    CPI_SCHEDQ_FULL,
+    CPI_OPERANDS,           // Dependence chains and execution latency
+    CPI_FU_BUSY,            // Ready instructions found every FU of their class taken
+    CPI_DCACHE_MISS,        // The ROB head is a load waiting on a D-cache miss
+    CPI_STORE_ORDER,        // A ready load or store was held back by an older one
+    NUM_CPI_CATEGORIES,
+} cpi_category_t;
+
 // This config struct is populated by the driver for you
 typedef struct {
     size_t fetch_width;
@@ -60,9 +118,38 @@ typedef struct {
     size_t num_alu_fus;
     size_t num_mul_fus;
     size_t num_lsu_fus;
+    // DispQ capacity, 0 for unlimited, up to MAX_DISPQ_ENTRIES. Fetch stalls
+    // while the DispQ is full
+    size_t num_dispq_entries;
+    // MSHRs for outstanding D-cache misses, 0 for LSUs that block on a miss
+    size_t num_mshrs;
+    // Private L2 and DRAM behind the D-cache (see memory.hpp). With
+    // l2_size_kib 0 there is no L2 and a D-cache miss costs L1_MISS_PENALTY
+    size_t l2_size_kib;
+    size_t l2_assoc;
+    size_t l2_latency;  // Cycles from a D-cache miss until an L2 hit's data
+    size_t l2_banks;
+    size_t dram_latency;  // Cycles an L2 miss adds
+    size_t dram_banks;
+    size_t dram_bank_busy;  // Cycles a DRAM bank is occupied by each access
+    // Data prefetcher, and how many lines it fetches ahead (0 for
+    // PREFETCH_DEFAULT_DEGREE)
+    prefetch_kind_t prefetcher;
+    size_t prefetch_degree;
+    // Whether loads may fire past older stores that have not executed
+    disambig_policy_t disambig_policy;
+    // Whether fetch redirects when a mispredicted branch completes rather
+    // than when it retires, and the cycles from its completion until the
+    // correct path is fetched
+    bool early_recovery;
+    size_t redirect_penalty;
 
-    // The driver sets this, you do not need to use this
+    // The driver sets these, you do not need to use them
     bool misses_enabled;
+    // Predictor used to recompute the trace's mispredict bits
+    bpred_kind_t branch_predictor;
+    // Whether to fill in the latency histograms, which slows simulation
+    bool latency_histograms;
 } procsim_conf_t;
 
 typedef struct {
@@ -72,6 +159,8 @@ typedef struct {
     uint64_t instructions_retired;
 
     uint64_t branch_mispredictions;
+    // Cycles in which fetch was held up by a mispredicted branch
+    uint64_t mispredict_recovery_cycles;
     uint64_t icache_misses;
 
     uint64_t reads;
@@ -79,6 +168,17 @@ typedef struct {
     uint64_t dcache_reads;
     uint64_t dcache_read_misses;
     uint64_t dcache_read_hits;
+    // D-cache read misses that went on to the shared or private L2, and its
+    // misses
+    uint64_t l2_reads;
+    uint64_t l2_read_misses;
+    // With the private L2, cycles from the D-cache miss until the data was
+    // back, summed over the L2 reads, and the part spent waiting for L2 banks.
+    // Then the same for the L2 misses' time past the L2 and in DRAM queues
+    uint64_t l2_read_cycles;
+    uint64_t l2_queue_cycles;
+    uint64_t dram_read_cycles;
+    uint64_t dram_queue_cycles;
     
     double store_buffer_hit_ratio;
     double dcache_read_miss_ratio;
@@ -86,6 +186,9 @@ typedef struct {
 
     double dcache_read_aat;
     double read_aat;
+    // Average cycles an L2 read and a DRAM read added, with the private L2
+    double l2_read_aat;
+    double dram_read_aat;
 
     // Incremented for each cycle in which we cannot dispatch 
     // due to not being able to find a free preg
@@ -95,8 +198,34 @@ typedef struct {
     // insufficient ROB space
     uint64_t rob_stall_cycles;
 
+    // Incremented for each cycle in which fetch stops because the DispQ is full
+    uint64_t dispq_full_cycles;
+
+    // D-cache read misses that waited on another miss's line fill, and cycles
+    // that misses spent waiting for a free MSHR, summed over the misses
+    uint64_t mshr_merged_reads;
+    uint64_t mshr_full_cycles;
+
+    // Prefetches issued, D-cache read misses that a prefetch turned into
+    // hits, and misses whose prefetch was still on its way
+    uint64_t prefetches_issued;
+    uint64_t prefetch_hits;
+    uint64_t prefetch_late_hits;
+
+    // Loads that fired past an older store that had not executed, those
+    // that read before such a store wrote their address, the pipeline
+    // squashes the violations caused, and the instructions squashed and
+    // fetched again
+    uint64_t speculative_loads;
+    uint64_t memory_violations;
+    uint64_t memory_squashes;
+    uint64_t replayed_instructions;
+
     // Incremented for each cycle in which we fired no instructions
     uint64_t no_fire_cycles;
+    // Retire slots charged to each cpi_category_t. They sum to
+    // fetch_width * cycles
+    uint64_t cpi_slots[NUM_CPI_CATEGORIES];
 
     // Maximum valid DispQ entries at the END of procsim_do_cycle()
     uint64_t dispq_max_size;
@@ -118,14 +247,31 @@ typedef struct {
 
     double ipc;
 
-    // The driver populates the stat below for you
+    // Per-opcode latency histograms of retired instructions, indexed by
+    // opcode - OPCODE_ADD, and the largest latency seen of each kind. Only
+    // filled in when conf->latency_histograms is set
+    uint64_t latency_hist[NUM_OPCODES][NUM_LATENCY_KINDS][LATENCY_BUCKETS];
+    uint64_t latency_max[NUM_OPCODES][NUM_LATENCY_KINDS];
+
+    // The driver populates the stats below for you
     uint64_t instructions_in_trace;
+    // Branches in the trace and how many of them the predictor got wrong
+    uint64_t branches_in_trace;
+    uint64_t branches_mispredicted_in_trace;
 } procsim_stats_t;
 
 // We have implemented this function for you in the driver. By calling it, you
 // are effectively reading from an icache with 100% hit rate, where branch
 // prediction is 100% correct and handled for you.
 extern const inst_t *procsim_driver_read_inst(void);
+// Also implemented in the driver: fetches up to max_insts instructions at
+// once, which are contiguous in the trace and start at *insts_out. Returns
+// how many, which is less than max_insts exactly when procsim_driver_read_inst()
+// would have returned NULL in their place
+extern size_t procsim_driver_read_insts(size_t max_insts, const inst_t **insts_out);
+// Also implemented in the driver: fetch starts over at inst, which has been
+// fetched before, once it and everything after it have been squashed
+extern void procsim_driver_refetch(const inst_t *inst);
 
 // There is more information on these functions in procsim.cpp
 extern void procsim_init(const procsim_conf_t *sim_conf,
@@ -133,5 +279,63 @@ extern void procsim_init(const procsim_conf_t *sim_conf,
 extern uint64_t procsim_do_cycle(procsim_stats_t *stats,
                                  bool *retired_mispredict_out);
 extern void procsim_finish(procsim_stats_t *stats);
+// Computes the averages and ratios from the counters, done by procsim_finish()
+extern void procsim_finalize_stats(procsim_stats_t *stats);
+
+/* histogram bucket of a latency, and the largest latency in a bucket */
+static inline size_t latency_bucket(uint64_t cycles) {
+    if (cycles < LATENCY_EXACT_LIMIT) return cycles;
+    // 3 and 2 are log2(LATENCY_EXACT_LIMIT) and log2(LATENCY_SUB_BUCKETS)
+    int log2 = 63 - __builtin_clzll(cycles);
+    size_t bucket = LATENCY_EXACT_LIMIT +
+        (log2 - 3) * LATENCY_SUB_BUCKETS + ((cycles >> (log2 - 2)) & (LATENCY_SUB_BUCKETS - 1));
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+static inline uint64_t latency_bucket_max(size_t bucket) {
+    if (bucket < LATENCY_EXACT_LIMIT) return bucket;
+    size_t log2 = 3 + (bucket - LATENCY_EXACT_LIMIT) / LATENCY_SUB_BUCKETS;
+    size_t sub = (bucket - LATENCY_EXACT_LIMIT) % LATENCY_SUB_BUCKETS;
+    return ((uint64_t)(LATENCY_SUB_BUCKETS + sub + 1) << (log2 - 2)) - 1;
+}
+
+// Every core has its own pipeline state. procsim_init() creates a core and
+// makes it the calling thread's current core, which procsim_do_cycle() and
+// procsim_finish() act on and procsim_finish() frees. Several cores can be
+// simulated from one thread by switching between them.
+typedef struct procsim_core procsim_core_t;
+extern procsim_core_t *procsim_current_core(void);
+extern void procsim_select_core(procsim_core_t *core);
+// Sends the current core's D-cache read misses on to a shared L2
+extern void procsim_attach_shared_l2(shared_l2_t *l2, size_t core_id);
+// Cycles the deadlock watchdog allows past its limit for the current core's
+// redirect penalty and slowest D-cache miss, 0 without early recovery or a
+// memory hierarchy
+extern uint64_t procsim_watchdog_allowance(void);
+// Adds the stall cycles of the current core's retiring instructions to a
+// per-PC profile (see hotspot.hpp)
+typedef struct hotspot_table hotspot_table_t;
+extern void procsim_attach_hotspots(hotspot_table_t *hotspots);
+// Loop memoization (see memo.hpp): a hash of the current core's pipeline
+// state, with instructions identified by their distance from head, and
+// moving every in-flight instruction insts places further along the trace,
+// where head is then the oldest one that has not retired
+extern uint64_t procsim_state_signature(const inst_t *head);
+extern void procsim_advance_trace(size_t insts, const inst_t *head);
+
+// Pipeline state that must match the reference model's (see procsim_ref.hpp)
+// after every cycle. ready and free point to NUM_REGS + num_pregs entries
+// each, allocated by the caller
+typedef struct {
+    size_t dispq_size;
+    size_t schedq_size;
+    size_t rob_size;
+    size_t stb_size;
+    unsigned long rat[NUM_REGS];
+    bool *ready;
+    bool *free;
+} procsim_snapshot_t;
+
+extern void procsim_snapshot(procsim_snapshot_t *snap);
 
 #endif
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "procsim_capi.h"
+#include "trace.hpp"
+
+struct procsim_trace {
+    inst_t *insts;
+    size_t n_insts;
+};
+
+struct procsim_context {
+    procsim_conf_t conf;
+    // Copy of the trace with this configuration's miss and mispredict bits
+    inst_t *insts;
+    size_t cap_insts;
+};
+
+int procsim_api_version(void) {
+    return PROCSIM_API_VERSION;
+}
+
+size_t procsim_api_conf_size(void) {
+    return sizeof(procsim_conf_t);
+}
+
+size_t procsim_api_stats_size(void) {
+    return sizeof(procsim_stats_t);
+}
+
+void procsim_conf_default(procsim_conf_t *conf) {
+    memset(conf, 0, sizeof *conf);
+    conf->num_pregs = 64;
+    conf->num_rob_entries = 96;
+    conf->num_schedq_entries_per_fu = 2;
+    conf->num_alu_fus = 2;
+    conf->num_mul_fus = 1;
+    conf->num_lsu_fus = 2;
+    conf->fetch_width = 2;
+    conf->misses_enabled = true;
+    conf->branch_predictor = BPRED_TRACE;
+    conf->redirect_penalty = DEFAULT_REDIRECT_PENALTY;
+}
+
+procsim_trace_t *procsim_trace_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror("fopen");
+        return NULL;
+    }
+    procsim_conf_t conf;
+    procsim_conf_default(&conf);
+    procsim_trace_t *trace = (procsim_trace_t *)calloc(1, sizeof(procsim_trace_t));
+    if (trace != NULL) {
+        trace->insts = trace_read(f, &trace->n_insts, &conf);
+        if (trace->insts == NULL) {
+            free(trace);
+            trace = NULL;
+        }
+    }
+    fclose(f);
+    return trace;
+}
+
+size_t procsim_trace_length(const procsim_trace_t *trace) {
+    return trace->n_insts;
+}
+
+void procsim_trace_free(procsim_trace_t *trace) {
+    if (trace == NULL) return;
+    free(trace->insts);
+    free(trace);
+}
+
+procsim_context_t *procsim_context_create(const procsim_conf_t *conf) {
+    if (conf->fetch_width == 0 || conf->num_rob_entries == 0 ||
+            conf->num_schedq_entries_per_fu == 0 || conf->num_pregs == 0 ||
+            conf->num_alu_fus == 0 || conf->num_mul_fus == 0 || conf->num_lsu_fus == 0 ||
+            conf->num_dispq_entries > MAX_DISPQ_ENTRIES ||
+            conf->branch_predictor < BPRED_TRACE || conf->branch_predictor > BPRED_TAGE) {
+        return NULL;
+    }
+    procsim_context_t *ctx = (procsim_context_t *)calloc(1, sizeof(procsim_context_t));
+    if (ctx == NULL) return NULL;
+    ctx->conf = *conf;
+    return ctx;
+}
+
+int procsim_context_run(procsim_context_t *ctx, const procsim_trace_t *trace,
+                        uint64_t max_insts, procsim_stats_t *stats_out) {
+    size_t n = (max_insts && max_insts < trace->n_insts) ? max_insts : trace->n_insts;
+    if (n > ctx->cap_insts) {
+        inst_t *insts = (inst_t *)realloc(ctx->insts, n * sizeof(inst_t));
+        if (insts == NULL) return -1;
+        ctx->insts = insts;
+        ctx->cap_insts = n;
+    }
+    memcpy(ctx->insts, trace->insts, n * sizeof(inst_t));
+    if (!ctx->conf.misses_enabled) {
+        for (size_t i = 0; i < n; i++) {
+            ctx->insts[i].mispredict = false;
+            ctx->insts[i].icache_miss = false;
+            ctx->insts[i].dcache_miss = false;
+        }
+        trace_index_fetch_events(ctx->insts, n);
+    }
+
+    memset(stats_out, 0, sizeof *stats_out);
+    if (trace_apply_branch_predictor(ctx->insts, n, &ctx->conf, stats_out) != 0) {
+        return -1;
+    }
+    return trace_simulate(&ctx->conf, ctx->insts, n, stats_out, NULL);
+}
+
+void procsim_context_destroy(procsim_context_t *ctx) {
+    if (ctx == NULL) return;
+    free(ctx->insts);
+    free(ctx);
+}
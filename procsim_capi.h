@@ -0,0 +1,50 @@
+#ifndef PROCSIM_CAPI_H
+#define PROCSIM_CAPI_H
+
+#include "procsim.hpp"
+
+// Stable C API of libprocsim, for driving the simulator in-process (e.g.,
+// from Python through ctypes, see pyprocsim.py). procsim_conf_t and
+// procsim_stats_t are shared with the simulator as-is; bindings should check
+// procsim_api_conf_size() and procsim_api_stats_size() against their copies.
+// Contexts may be run concurrently from different threads, and traces may be
+// shared between them.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a struct layout or function signature changes
+#define PROCSIM_API_VERSION 9
+
+int procsim_api_version(void);
+size_t procsim_api_conf_size(void);
+size_t procsim_api_stats_size(void);
+
+/* the configuration the procsim executable runs without options */
+void procsim_conf_default(procsim_conf_t *conf);
+
+typedef struct procsim_trace procsim_trace_t;
+
+/* Load a text trace with its miss and mispredict bits intact; each run
+ * applies its own configuration to them. Returns NULL on error */
+procsim_trace_t *procsim_trace_load(const char *path);
+size_t procsim_trace_length(const procsim_trace_t *trace);
+void procsim_trace_free(procsim_trace_t *trace);
+
+typedef struct procsim_context procsim_context_t;
+
+/* Returns NULL if the configuration is unusable or on allocation failure */
+procsim_context_t *procsim_context_create(const procsim_conf_t *conf);
+/* Simulate the first max_insts instructions of the trace (all of them when
+ * max_insts is 0) and write the results to *stats_out.
+ * Returns 0 on success, -1 on a deadlock or allocation failure */
+int procsim_context_run(procsim_context_t *ctx, const procsim_trace_t *trace,
+                        uint64_t max_insts, procsim_stats_t *stats_out);
+void procsim_context_destroy(procsim_context_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
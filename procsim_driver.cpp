@@ -1,21 +1,126 @@
-// You do not need to modify this file!
-
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <math.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "procsim.hpp"
+#include "estimate.hpp"
+#include "hotspot.hpp"
+#include "memo.hpp"
+#include "memory.hpp"
+#include "procsim_capi.h"
+#include "procsim_ref.hpp"
+#include "result_cache.hpp"
+#include "serve.hpp"
+#include "trace.hpp"
+#include "trace_deps.hpp"
 
 static size_t n_insts;
 static inst_t *insts;
-static uint64_t fetch_inst_idx;
+// Dependence annotations from the trace's sidecar, NULL unless --deps is given
+static inst_deps_t *deps;
+// Per-PC stall profile, NULL unless --hotspots is given
+static hotspot_table_t *hotspots;
+
+// Relative hardware cost weights used by the Pareto search
+#define COST_ALU_FU 1.0
+#define COST_MUL_FU 3.0
+#define COST_LSU_FU 2.0
+#define COST_SCHEDQ_ENTRY 0.25
+#define COST_PREG 0.05
+#define COST_FETCH_SLOT 1.0
+
+// The first Pareto search round simulates 1/PARETO_FIRST_PREFIX of the trace
+#define PARETO_FIRST_PREFIX 16
+#define PARETO_MIN_PREFIX 1000
+#define PARETO_DEFAULT_MARGIN 0.01
+// Each prefix gives one CPI sample per 1/PARETO_BATCHES of it
+#define PARETO_BATCHES 16
+
+// Limits of the configuration space with --experimental
+#define EXPERIMENTAL_MAX_FETCH_WIDTH 64
+#define EXPERIMENTAL_MAX_SCHEDQ_PER_FU 256
+#define EXPERIMENTAL_MAX_PREGS 8192
+#define EXPERIMENTAL_MAX_ROB_ENTRIES 65536
+#define EXPERIMENTAL_MAX_FUS 32
+
+// Multi-core runs, one core per -I trace
+#define MAX_CORES 64
+#define MULTICORE_DEFAULT_QUANTUM 1000
+#define MAX_QUANTUM 1000000000
+#define SHARED_L2_ASSOC 8
+
+#define MAX_MSHRS 64
+
+// Segmented runs warm each segment up on this many preceding instructions
+#define SEGMENT_DEFAULT_WARMUP 1000
+// Each segment runs on its own host thread
+#define MAX_SEGMENTS 256
+
+// Most PCs --hotspots prints
+#define MAX_HOTSPOTS 65536
+
+// Early-terminated runs measure IPC over batches of this many cycles, and
+// stop no sooner than after EARLY_MIN_BATCHES of them
+#define EARLY_DEFAULT_BATCH_CYCLES 2000
+#define EARLY_MAX_BATCH_CYCLES 1000000000
+#define EARLY_MIN_BATCHES 10
+
+// Values returned by getopt_long() for options without a short form
+enum {
+    OPT_PARETO = 256,
+    OPT_PARETO_MARGIN,
+    OPT_DEPS,
+    OPT_ESTIMATE,
+    OPT_ESTIMATE_CHECK,
+    OPT_EXPERIMENTAL,
+    OPT_HOST_TIMING,
+    OPT_QUANTUM,
+    OPT_SHARED_L2,
+    OPT_SEGMENTS,
+    OPT_WARMUP,
+    OPT_SEGMENTS_CHECK,
+    OPT_CACHE,
+    OPT_CACHE_DIR,
+    OPT_LATENCY,
+    OPT_CPI_STACK,
+    OPT_HOTSPOTS,
+    OPT_PRECISION,
+    OPT_BATCH_CYCLES,
+    OPT_MSHRS,
+    OPT_L2,
+    OPT_L2_ASSOC,
+    OPT_L2_LATENCY,
+    OPT_L2_BANKS,
+    OPT_DRAM_LATENCY,
+    OPT_DRAM_BANKS,
+    OPT_DRAM_BANK_BUSY,
+    OPT_PREFETCH,
+    OPT_PREFETCH_DEGREE,
+    OPT_DISAMBIG,
+    OPT_MEMOIZE,
+    OPT_SERVE,
+    OPT_SOCKET,
+    OPT_SERVE_THREADS,
+    OPT_DIFF_REF,
+    OPT_EARLY_RECOVERY,
+    OPT_REDIRECT_PENALTY,
+};
 
 // Print error usage
 static void print_err_usage(const char *err) {
     fprintf(stderr, "%s\n", err);
-    fprintf(stderr, "./procsim -I <trace file> [Options]\n");
+    fprintf(stderr, "./procsim -I <trace file> [-I <trace file> ...] [Options]\n");
     fprintf(stderr, "-F <fetch width>\n");
     fprintf(stderr, "-P <number of Physical Registers>\n");
     fprintf(stderr, "-A <number of ALU FUs>\n");
@@ -23,12 +128,112 @@ static void print_err_usage(const char *err) {
     fprintf(stderr, "-L <number of load/store FUs>\n");
     fprintf(stderr, "-S <number of SchedQ entries per FU>\n");
     fprintf(stderr, "-D disables Cache Misses and Interrupts\n");
+    fprintf(stderr, "-B <branch predictor: trace, bimodal, gshare or tage>\n");
+    fprintf(stderr, "-R <number of ROB entries> (requires --experimental, default P + 32)\n");
+    fprintf(stderr, "-Q <number of DispQ entries> up to %d (default 0, unlimited)\n", MAX_DISPQ_ENTRIES);
+    fprintf(stderr, "--mshrs <N> lets loads miss under misses, up to N lines at once\n"
+                    "         (at most %d, default 0, a D-cache miss blocks its LSU)\n", MAX_MSHRS);
+    fprintf(stderr, "--l2 <KiB> adds a private L2 and DRAM behind the D-cache, whose misses\n"
+                    "         otherwise all cost %d cycles\n", L1_MISS_PENALTY);
+    fprintf(stderr, "--l2-assoc <ways> (default %d)\n", MEMORY_DEFAULT_L2_ASSOC);
+    fprintf(stderr, "--l2-latency <cycles> from a D-cache miss to an L2 hit's data (default %d)\n",
+            MEMORY_DEFAULT_L2_LATENCY);
+    fprintf(stderr, "--l2-banks <N> (default %d)\n", MEMORY_DEFAULT_L2_BANKS);
+    fprintf(stderr, "--dram-latency <cycles> added by an L2 miss (default %d)\n",
+            MEMORY_DEFAULT_DRAM_LATENCY);
+    fprintf(stderr, "--dram-banks <N> (default %d)\n", MEMORY_DEFAULT_DRAM_BANKS);
+    fprintf(stderr, "--dram-bank-busy <cycles> a DRAM bank is occupied per access (default %d)\n",
+            MEMORY_DEFAULT_DRAM_BANK_BUSY);
+    fprintf(stderr, "--prefetch <data prefetcher: none, next-line, stride or stream>\n");
+    fprintf(stderr, "--prefetch-degree <lines> fetched ahead per prefetch, up to %d (default %d)\n",
+            PREFETCH_MAX_DEGREE, PREFETCH_DEFAULT_DEGREE);
+    fprintf(stderr, "--disambig <load/store ordering: conservative, speculative or store-sets>\n");
+    fprintf(stderr, "--early-recovery redirects fetch when a mispredicted branch executes\n"
+                    "         rather than when it retires\n");
+    fprintf(stderr, "--redirect-penalty <cycles> from the branch executing until the correct\n"
+                    "         path is fetched, up to %d (default %d)\n",
+            MAX_REDIRECT_PENALTY, DEFAULT_REDIRECT_PENALTY);
     fprintf(stderr, "-H prints this message\n");
+    fprintf(stderr, "--pareto searches all valid FU, SchedQ, preg and fetch width\n"
+                    "         configurations for the IPC versus cost Pareto frontier\n");
+    fprintf(stderr, "--pareto-margin <fraction> widens the IPC bounds that prune configurations\n"
+                    "         on trace prefixes by this fraction (default %.3f)\n", PARETO_DEFAULT_MARGIN);
+    fprintf(stderr, "--deps loads dependence annotations from <trace file>.deps, building\n"
+                    "         the sidecar first if it is missing or stale\n");
+    fprintf(stderr, "--estimate prints analytical IPC estimates instead of simulating\n");
+    fprintf(stderr, "--estimate-check prints the estimates, simulates, and reports their error\n");
+    fprintf(stderr, "--experimental lifts the F, S, P, A, M and L limits and allows -R, to\n"
+                    "         model cores larger than the validated configurations\n");
+    fprintf(stderr, "--host-timing reports the host time spent simulating\n");
+    fprintf(stderr, "--cpi-stack prints the cycles lost to each cause, summing to the total\n");
+    fprintf(stderr, "--hotspots <N> prints the N PCs that spent the most cycles stalled\n");
+    fprintf(stderr, "--latency prints per-opcode queue, execute and ROB latency percentiles\n");
+    fprintf(stderr, "--cache reuses results of earlier runs of the same trace and configuration\n");
+    fprintf(stderr, "--cache-dir <dir> to keep cached results in (default %s), implies --cache\n",
+            RESULT_CACHE_DEFAULT_DIR);
+    fprintf(stderr, "With several -I traces, each runs on its own core and host thread:\n");
+    fprintf(stderr, "--quantum <cycles> between core synchronizations (default %d)\n",
+            MULTICORE_DEFAULT_QUANTUM);
+    fprintf(stderr, "--shared-l2 <KiB> adds an L2 shared by the cores behind the D-caches\n");
+    fprintf(stderr, "--segments <K> splits the trace into K segments simulated in parallel,\n"
+                    "         up to %d\n", MAX_SEGMENTS);
+    fprintf(stderr, "--warmup <instructions> simulated before each segment to warm it up\n"
+                    "         (default %d)\n", SEGMENT_DEFAULT_WARMUP);
+    fprintf(stderr, "--segments-check also simulates serially and reports the divergence\n");
+    fprintf(stderr, "--precision <fraction> stops once the 95%% confidence interval of the IPC\n"
+                    "         is within this fraction of it, extrapolating the counters\n");
+    fprintf(stderr, "--batch-cycles <cycles> per IPC sample for --precision (default %d)\n",
+            EARLY_DEFAULT_BATCH_CYCLES);
+    fprintf(stderr, "--memoize skips loop iterations that repeat the pipeline's steady state,\n"
+                    "         extrapolating their cycles and counters\n");
+    fprintf(stderr, "--diff-ref also simulates the original pipeline model, comparing the\n"
+                    "         two every cycle and stopping at the first difference\n");
+    fprintf(stderr, "--serve loads the -I traces once and simulates the job lines read from\n"
+                    "         stdin, writing a result line for each (see serve.hpp)\n");
+    fprintf(stderr, "--socket <path> serves the clients of a Unix-domain socket instead of stdin\n");
+    fprintf(stderr, "--serve-threads <N> simulate jobs at once, up to %d (default: one per\n"
+                    "         host CPU)\n", MAX_SERVE_THREADS);
 
     exit(EXIT_FAILURE);
 }
 
-static bool validate_sim_config(procsim_conf_t *sim_conf) {
+/* true if v is within [lo, hi], printing an error for option name otherwise */
+static bool check_range(const char *name, size_t v, size_t lo, size_t hi) {
+    if (v < lo || v > hi) {
+        fprintf(stderr, "Invalid %s: %" PRIu64 " (must be %" PRIu64 " to %" PRIu64 " with --experimental)\n",
+                name, v, lo, hi);
+        return false;
+    }
+    return true;
+}
+
+/* true if s is a number in [0, 1), storing it in *out */
+static bool parse_fraction(const char *s, double *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || *end != '\0' || !(v >= 0 && v < 1)) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+/* true if s is a whole number no greater than max, storing it in *out */
+static bool parse_count(const char *s, size_t max, size_t *out) {
+    char *end;
+    if (!isdigit((unsigned char)s[0])) {
+        return false;
+    }
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 10);
+    if (errno != 0 || *end != '\0' || v > max) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+static bool validate_sim_config(procsim_conf_t *sim_conf, bool experimental) {
     size_t f = sim_conf->fetch_width;
     size_t s = sim_conf->num_schedq_entries_per_fu;
     size_t p = sim_conf->num_pregs;
@@ -36,6 +241,31 @@ static bool validate_sim_config(procsim_conf_t *sim_conf) {
     size_t l = sim_conf->num_lsu_fus;
     size_t m = sim_conf->num_mul_fus;
     bool valid = true;
+    if (sim_conf->num_dispq_entries > MAX_DISPQ_ENTRIES) {
+        fprintf(stderr, "Invalid number of DispQ entries: %zu (at most %d)\n",
+                sim_conf->num_dispq_entries, MAX_DISPQ_ENTRIES);
+        valid = false;
+    }
+    if (sim_conf->num_mshrs > MAX_MSHRS) {
+        fprintf(stderr, "Invalid number of MSHRs: %zu (at most %d)\n", sim_conf->num_mshrs, MAX_MSHRS);
+        valid = false;
+    }
+    if (sim_conf->l2_size_kib &&
+            sim_conf->l2_size_kib * 1024 % (sim_conf->l2_assoc * CACHE_LINE_SIZE) != 0) {
+        fprintf(stderr, "Invalid L2: %zu KiB is not a whole number of %zu-way sets of %d B lines\n",
+                sim_conf->l2_size_kib, sim_conf->l2_assoc, CACHE_LINE_SIZE);
+        valid = false;
+    }
+    if (experimental) {
+        valid &= check_range("F", f, 1, EXPERIMENTAL_MAX_FETCH_WIDTH);
+        valid &= check_range("S", s, 1, EXPERIMENTAL_MAX_SCHEDQ_PER_FU);
+        valid &= check_range("P", p, 1, EXPERIMENTAL_MAX_PREGS);
+        valid &= check_range("R", sim_conf->num_rob_entries, 1, EXPERIMENTAL_MAX_ROB_ENTRIES);
+        valid &= check_range("A", a, 1, EXPERIMENTAL_MAX_FUS);
+        valid &= check_range("L", l, 1, EXPERIMENTAL_MAX_FUS);
+        valid &= check_range("M", m, 1, EXPERIMENTAL_MAX_FUS);
+        return valid;
+    }
     if (!(f == 2 || f == 4 || f == 8)) {
         fprintf(stderr, "Invalid F: %" PRIu64 "\n", f);
         valid = false;
@@ -74,12 +304,37 @@ static void print_sim_config(procsim_conf_t *sim_conf) {
     printf("Num. LSU FUs: %lu\n", sim_conf->num_lsu_fus);
     printf("Num. SchedQ entries per FU: %lu\n", sim_conf->num_schedq_entries_per_fu);
     
+    if (sim_conf->num_dispq_entries) {
+        printf("Num. DispQ entries: %lu\n", sim_conf->num_dispq_entries);
+    }
+    if (sim_conf->num_mshrs) {
+        printf("Num. MSHRs: %lu\n", sim_conf->num_mshrs);
+    }
+    if (sim_conf->l2_size_kib) {
+        printf("L2:   %lu KiB, %lu-way, %lu cycles, %lu banks\n", sim_conf->l2_size_kib,
+               sim_conf->l2_assoc, sim_conf->l2_latency, sim_conf->l2_banks);
+        printf("DRAM: %lu cycles, %lu banks busy for %lu cycles per access\n",
+               sim_conf->dram_latency, sim_conf->dram_banks, sim_conf->dram_bank_busy);
+    }
     printf("Misses:   %s\n", sim_conf->misses_enabled ? "enabled"
                                                              : "disabled");
+    if (sim_conf->branch_predictor != BPRED_TRACE) {
+        printf("Branch predictor: %s\n", bpred_kind_name(sim_conf->branch_predictor));
+    }
+    if (sim_conf->prefetcher != PREFETCH_NONE) {
+        printf("Prefetcher: %s, degree %lu\n", prefetch_kind_name(sim_conf->prefetcher),
+               sim_conf->prefetch_degree);
+    }
+    if (sim_conf->disambig_policy != DISAMBIG_CONSERVATIVE) {
+        printf("Disambiguation: %s\n", disambig_policy_name(sim_conf->disambig_policy));
+    }
+    if (sim_conf->early_recovery) {
+        printf("Branch recovery: at execute, %zu cycle redirect\n", sim_conf->redirect_penalty);
+    }
 }
 
 // Function to print the simulation output
-static void print_sim_output(procsim_stats_t *sim_stats) {
+static void print_sim_output(const procsim_conf_t *sim_conf, procsim_stats_t *sim_stats) {
     printf("\nSIMULATION OUTPUT\n");
     printf("Cycles:                     %" PRIu64 "\n", sim_stats->cycles);
     printf("Trace instructions:         %" PRIu64 "\n", sim_stats->instructions_in_trace);
@@ -90,9 +345,47 @@ static void print_sim_output(procsim_stats_t *sim_stats) {
     printf("D-Cache reads:              %" PRIu64 "\n", sim_stats->dcache_reads);
     printf("Store Buffer hits:          %" PRIu64 "\n", sim_stats->store_buffer_read_hits);
     printf("Read AAT:                   %.3f\n", sim_stats->read_aat);
+    if (sim_stats->l2_read_cycles) {
+        printf("D-Cache read AAT:           %.3f\n", sim_stats->dcache_read_aat);
+        printf("L2 read misses:             %" PRIu64 " / %" PRIu64 "\n",
+               sim_stats->l2_read_misses, sim_stats->l2_reads);
+        printf("L2 read AAT:                %.3f (%.3f queued)\n", sim_stats->l2_read_aat,
+               (double)sim_stats->l2_queue_cycles / sim_stats->l2_reads);
+        if (sim_stats->l2_read_misses) {
+            printf("DRAM read AAT:              %.3f (%.3f queued)\n", sim_stats->dram_read_aat,
+                   (double)sim_stats->dram_queue_cycles / sim_stats->l2_read_misses);
+        }
+    }
     printf("Branch Mispredictions:      %" PRIu64 "\n", sim_stats->branch_mispredictions);
+    if (sim_conf->early_recovery) {
+        printf("Mispredict recovery cycles: %" PRIu64 "\n", sim_stats->mispredict_recovery_cycles);
+    }
     printf("Stall cycles due to PREGs:  %" PRIu64 "\n", sim_stats->no_dispatch_pregs_cycles);
     printf("Stall cycles due to ROB:    %" PRIu64 "\n", sim_stats->rob_stall_cycles);
+    if (sim_stats->dispq_full_cycles) {
+        printf("Stall cycles due to DispQ:  %" PRIu64 "\n", sim_stats->dispq_full_cycles);
+    }
+    if (sim_stats->mshr_merged_reads || sim_stats->mshr_full_cycles) {
+        printf("Misses merged into MSHRs:   %" PRIu64 "\n", sim_stats->mshr_merged_reads);
+        printf("Miss cycles waiting for MSHRs: %" PRIu64 "\n", sim_stats->mshr_full_cycles);
+    }
+    if (sim_stats->prefetches_issued) {
+        uint64_t useful = sim_stats->prefetch_hits + sim_stats->prefetch_late_hits;
+        // Read misses there would have been without prefetching
+        uint64_t misses = sim_stats->dcache_read_misses + sim_stats->prefetch_hits;
+        printf("Prefetches issued:          %" PRIu64 "\n", sim_stats->prefetches_issued);
+        printf("Prefetch accuracy:          %.3f%%\n",
+               100.0 * useful / sim_stats->prefetches_issued);
+        printf("Prefetch coverage:          %.3f%%\n", misses ? 100.0 * useful / misses : 0.0);
+        printf("Prefetch timeliness:        %.3f%%\n",
+               useful ? 100.0 * sim_stats->prefetch_hits / useful : 0.0);
+    }
+    if (sim_stats->speculative_loads || sim_stats->memory_violations) {
+        printf("Speculative loads:          %" PRIu64 "\n", sim_stats->speculative_loads);
+        printf("Memory order violations:    %" PRIu64 "\n", sim_stats->memory_violations);
+        printf("Memory order squashes:      %" PRIu64 "\n", sim_stats->memory_squashes);
+        printf("Instructions replayed:      %" PRIu64 "\n", sim_stats->replayed_instructions);
+    }
     printf("Cycles with no fires:       %" PRIu64 "\n", sim_stats->no_fire_cycles);
     printf("Max DispQ usage:      %" PRIu64 "\n", sim_stats->dispq_max_size);
     printf("Average DispQ usage:  %.3f\n", sim_stats->dispq_avg_size);
@@ -101,121 +394,1044 @@ static void print_sim_output(procsim_stats_t *sim_stats) {
     printf("Max ROB usage:        %" PRIu64 "\n", sim_stats->rob_max_size);
     printf("Average ROB usage:    %.3f\n", sim_stats->rob_avg_size);
     printf("IPC:                  %.3f\n", sim_stats->ipc);
+    if (sim_stats->branches_in_trace) {
+        printf("Branch prediction accuracy: %.3f%%\n", 100.0 *
+               (sim_stats->branches_in_trace - sim_stats->branches_mispredicted_in_trace) /
+               sim_stats->branches_in_trace);
+    }
+}
+
+// Prints the CPI stack: each category's retire slots as cycles, which sum to
+// the total cycles, and as CPI, which sums to 1 / IPC
+static void print_cpi_stack(const procsim_stats_t *sim_stats) {
+    static const char *const names[NUM_CPI_CATEGORIES] = {
+        "Retiring", "I-Cache miss", "Mispredict recovery", "ROB full", "PREGs exhausted",
+        "SchedQ full", "Waiting on operands", "FU structural hazard", "D-Cache miss",
+        "Store ordering",
+    };
+    uint64_t slots = 0;
+    for (int c = 0; c < NUM_CPI_CATEGORIES; c++) slots += sim_stats->cpi_slots[c];
+    if (sim_stats->cycles == 0 || sim_stats->instructions_retired == 0) return;
+    double width = (double)slots / sim_stats->cycles;
+    printf("\nCPI STACK\n");
+    printf("Category              Cycles         CPI     Share\n");
+    for (int c = 0; c < NUM_CPI_CATEGORIES; c++) {
+        double cycles = sim_stats->cpi_slots[c] / width;
+        printf("%-21s %-14.1f %-7.3f %5.1f%%\n", names[c], cycles,
+               cycles / sim_stats->instructions_retired, 100.0 * sim_stats->cpi_slots[c] / slots);
+    }
+    printf("%-21s %-14" PRIu64 " %-7.3f %5.1f%%\n", "Total", sim_stats->cycles,
+           (double)sim_stats->cycles / sim_stats->instructions_retired, 100.0);
+}
+
+/* smallest bucket upper bound covering the given fraction of the samples,
+ * capped at the largest latency seen */
+static uint64_t latency_percentile(const uint64_t *hist, uint64_t count, uint64_t max,
+                                   double fraction) {
+    uint64_t target = (uint64_t)(fraction * count + 0.5);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    int b;
+    for (b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        seen += hist[b];
+        if (seen >= target) break;
+    }
+    uint64_t bound = latency_bucket_max(b);
+    return bound < max ? bound : max;
+}
+
+// Prints the percentiles of each opcode's latency histograms. Latencies of
+// LATENCY_EXACT_LIMIT cycles or more are bucketed, so their percentiles are
+// the upper bound of the bucket they fall in.
+static void print_latency_output(const procsim_stats_t *sim_stats) {
+    static const char *const opcode_names[NUM_OPCODES] = {"ADD", "MUL", "LOAD", "STORE", "BRANCH"};
+    static const char *const kind_names[NUM_LATENCY_KINDS] = {"queue", "exec", "rob"};
+    printf("\nLATENCY PERCENTILES (cycles)\n");
+    printf("Opcode  Latency  Count        p50     p90     p99     Max\n");
+    for (int op = 0; op < NUM_OPCODES; op++) {
+        for (int k = 0; k < NUM_LATENCY_KINDS; k++) {
+            const uint64_t *hist = sim_stats->latency_hist[op][k];
+            uint64_t max = sim_stats->latency_max[op][k];
+            uint64_t count = 0;
+            for (int b = 0; b < LATENCY_BUCKETS; b++) count += hist[b];
+            if (count == 0) continue;
+            printf("%-7s %-8s %-12" PRIu64 " %-7" PRIu64 " %-7" PRIu64 " %-7" PRIu64 " %" PRIu64 "\n",
+                   opcode_names[op], kind_names[k], count,
+                   latency_percentile(hist, count, max, 0.50),
+                   latency_percentile(hist, count, max, 0.90),
+                   latency_percentile(hist, count, max, 0.99), max);
+        }
+    }
+}
+
+// Prints the n PCs whose retired instructions spent the most cycles stalled
+static void print_hotspots(const hotspot_table_t *table, size_t n) {
+    static const char *const opcode_names[NUM_OPCODES] = {"ADD", "MUL", "LOAD", "STORE", "BRANCH"};
+    hotspot_entry_t *top = (hotspot_entry_t *)malloc((n ? n : 1) * sizeof(hotspot_entry_t));
+    if (top == NULL) {
+        perror("malloc");
+        return;
+    }
+    n = hotspot_top(table, n, top);
+    printf("\nHOTSPOTS (stall cycles summed over each PC's retired instructions)\n");
+    printf("PC          Opcode  Retired     ROB head    Operands    Disambig.   D-Cache miss\n");
+    for (size_t i = 0; i < n; i++) {
+        const hotspot_entry_t *e = &top[i];
+        printf("0x%-9" PRIx64 " %-7s %-11" PRIu64 " %-11" PRIu64 " %-11" PRIu64 " %-11" PRIu64 " %" PRIu64 "\n",
+               e->pc, opcode_names[e->opcode - OPCODE_ADD], e->retired,
+               e->cycles[HOTSPOT_HEAD], e->cycles[HOTSPOT_OPERANDS],
+               e->cycles[HOTSPOT_DISAMBIG], e->cycles[HOTSPOT_DCACHE_MISS]);
+    }
+    free(top);
+}
+
+// Simulates the first limit_insts instructions of the loaded trace (the whole
+// trace when limit_insts is 0 or too large) and fills in *sim_stats, which
+// must be zeroed by the caller, adding to the profile unless it is NULL.
+// Returns 0 on success and -1 on a deadlock.
+static int run_simulation(procsim_conf_t *sim_conf, procsim_stats_t *sim_stats,
+                          size_t limit_insts, hotspot_table_t *profile) {
+    return trace_simulate(sim_conf, insts,
+                          (limit_insts && limit_insts < n_insts) ? limit_insts : n_insts,
+                          sim_stats, profile);
+}
+
+/* relative hardware cost of a configuration, used for the Pareto search */
+static double config_cost(const procsim_conf_t *conf) {
+    size_t num_fus = conf->num_alu_fus + conf->num_mul_fus + conf->num_lsu_fus;
+    return COST_ALU_FU * conf->num_alu_fus +
+           COST_MUL_FU * conf->num_mul_fus +
+           COST_LSU_FU * conf->num_lsu_fus +
+           COST_SCHEDQ_ENTRY * conf->num_schedq_entries_per_fu * num_fus +
+           COST_PREG * conf->num_pregs +
+           COST_FETCH_SLOT * conf->fetch_width;
+}
+
+typedef struct {
+    procsim_conf_t conf;
+    double cost;
+    double ipc;      // Over the instructions simulated so far
+    double ipc_lo;   // Bounds on the IPC of the whole trace
+    double ipc_hi;
+    bool alive;
+    // The configuration's run over the whole trace, paused between rounds
+    trace_cursor_t cursor;
+    procsim_core_t *core;
+    procsim_stats_t stats;
+    // Of the CPIs of the run's batches so far
+    double cpi_sum;
+    double cpi_sum_sq;
+    size_t num_batches;
+    uint64_t batch_start_insts;
+    uint64_t batch_start_cycles;
+} pareto_point_t;
+
+static int compare_pareto_cost(const void *a, const void *b) {
+    const pareto_point_t *pa = *(const pareto_point_t *const *)a;
+    const pareto_point_t *pb = *(const pareto_point_t *const *)b;
+    if (pa->cost != pb->cost) return pa->cost < pb->cost ? -1 : 1;
+    if (pa->ipc != pb->ipc) return pa->ipc > pb->ipc ? -1 : 1;
+    return 0;
+}
+
+/* two-sided 95% Student t critical value */
+static double t_critical_95(size_t dof) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    return dof == 0 ? INFINITY : dof <= 30 ? table[dof - 1] : 1.960;
+}
+
+// Runs a Pareto search configuration on until it has retired prefix
+// instructions, then bounds its IPC over the whole trace. The cycles simulated
+// so far are known. The rest of the trace is taken to run at the mean CPI of
+// the run's batches of batch_insts instructions, give or take a 95% prediction
+// interval widened by margin, but never faster than fetch_width instructions
+// per cycle. Returns 0 on success and -1 on a deadlock.
+static int advance_pareto_point(pareto_point_t *point, size_t prefix, size_t batch_insts,
+                                double margin) {
+    trace_cursor_t *c = &point->cursor;
+    procsim_stats_t *stats = &point->stats;
+    trace_cursor_select(c);
+    procsim_select_core(point->core);
+    while (!trace_cursor_done(c) && c->retired_inst_idx < prefix) {
+        if (trace_cursor_cycle(stats) != 0) {
+            return -1;
+        }
+        if (c->retired_inst_idx - point->batch_start_insts < batch_insts) {
+            continue;
+        }
+        double cpi = (double)(stats->cycles - point->batch_start_cycles) /
+                     (c->retired_inst_idx - point->batch_start_insts);
+        point->batch_start_insts = c->retired_inst_idx;
+        point->batch_start_cycles = stats->cycles;
+        point->cpi_sum += cpi;
+        point->cpi_sum_sq += cpi * cpi;
+        point->num_batches++;
+    }
+
+    point->ipc = (double)c->retired_inst_idx / stats->cycles;
+    if (trace_cursor_done(c)) {
+        point->ipc_lo = point->ipc_hi = point->ipc;
+        return 0;
+    }
+    size_t n = point->num_batches;
+    double rest = (double)(n_insts - c->retired_inst_idx);
+    double mean = n ? point->cpi_sum / n : 0;
+    double half_width = INFINITY;
+    if (n >= 2) {
+        double var = (point->cpi_sum_sq - n * mean * mean) / (n - 1);
+        double rest_batches = rest / batch_insts < 1 ? 1 : rest / batch_insts;
+        half_width = t_critical_95(n - 1) *
+                     sqrt((var > 0 ? var : 0) * (1.0 / n + 1.0 / rest_batches));
+    }
+    double min_cpi = 1.0 / point->conf.fetch_width;
+    double cpi_lo = (mean - half_width) * (1 - margin);
+    double cpi_hi = (mean + half_width) * (1 + margin);
+    point->ipc_hi = n_insts / (stats->cycles + rest * (cpi_lo > min_cpi ? cpi_lo : min_cpi));
+    point->ipc_lo = n_insts / (stats->cycles + rest * cpi_hi);
+    return 0;
 }
 
-static inst_t *read_entire_trace(FILE *trace, size_t *size_insts_out, procsim_conf_t *sim_conf) {
-    size_t size_insts = 0;
-    size_t cap_insts = 0;
-    inst_t *insts_arr = NULL;
+/* end a Pareto search configuration's run, freeing its core */
+static void finish_pareto_point(pareto_point_t *point) {
+    if (point->core == NULL) {
+        return;
+    }
+    procsim_select_core(point->core);
+    point->stats.instructions_in_trace = n_insts;
+    procsim_finish(&point->stats);
+    point->core = NULL;
+}
+
+// Searches every valid configuration for the IPC versus hardware cost Pareto
+// frontier. A configuration is dominated when another configuration that costs
+// no more is certain to reach at least its IPC. Every configuration runs over
+// the whole trace, paused whenever it has retired a prefix that doubles each
+// round, starting at 1/PARETO_FIRST_PREFIX of the trace. After every round, a
+// configuration is dropped only when the lower bound on the whole-trace IPC of
+// one that costs no more is at least its own upper bound, and carried into the
+// next round otherwise. The last round runs to the end of the trace, where
+// the bounds are the exact IPC of a full run.
+static int pareto_search(const procsim_conf_t *base_conf, double margin) {
+    static const size_t fetch_widths[] = {2, 4, 8};
+    static const size_t num_pregs[] = {64, 96, 128};
+    static const size_t schedq_sizes[] = {2, 4, 8};
+    static const size_t num_alus[] = {1, 2, 3};
+    static const size_t num_muls[] = {1, 2};
+    static const size_t num_lsus[] = {1, 2, 3};
+#define COUNT(arr) (sizeof (arr) / sizeof (arr)[0])
 
-    while (!feof(trace)) {
-        if (size_insts == cap_insts) {
-            size_t new_cap_insts = 2 * (cap_insts + 1);
-            // redundant c++ cast #1
-            inst_t *new_insts_arr = (inst_t *)realloc(insts_arr, new_cap_insts * sizeof *insts_arr);
-            if (!new_insts_arr) {
-                perror("realloc");
-                goto error;
+    size_t num_points = COUNT(fetch_widths) * COUNT(num_pregs) * COUNT(schedq_sizes) *
+                        COUNT(num_alus) * COUNT(num_muls) * COUNT(num_lsus);
+    pareto_point_t *points = (pareto_point_t *)calloc(num_points, sizeof(pareto_point_t));
+    pareto_point_t **sorted = (pareto_point_t **)calloc(num_points, sizeof(pareto_point_t *));
+    if (!points || !sorted) {
+        perror("calloc");
+        free(points);
+        free(sorted);
+        return -1;
+    }
+
+    size_t n = 0;
+    for (size_t f = 0; f < COUNT(fetch_widths); f++)
+    for (size_t p = 0; p < COUNT(num_pregs); p++)
+    for (size_t s = 0; s < COUNT(schedq_sizes); s++)
+    for (size_t a = 0; a < COUNT(num_alus); a++)
+    for (size_t m = 0; m < COUNT(num_muls); m++)
+    for (size_t l = 0; l < COUNT(num_lsus); l++) {
+        procsim_conf_t *conf = &points[n].conf;
+        *conf = *base_conf;
+        conf->fetch_width = fetch_widths[f];
+        conf->num_pregs = num_pregs[p];
+        conf->num_rob_entries = num_pregs[p] + 32;
+        conf->num_schedq_entries_per_fu = schedq_sizes[s];
+        conf->num_alu_fus = num_alus[a];
+        conf->num_mul_fus = num_muls[m];
+        conf->num_lsu_fus = num_lsus[l];
+        points[n].cost = config_cost(conf);
+        points[n].alive = true;
+        trace_cursor_init(&points[n].cursor, insts, n_insts);
+        procsim_init(conf, &points[n].stats);
+        points[n].core = procsim_current_core();
+        n++;
+    }
+#undef COUNT
+
+    printf("PARETO SEARCH\n");
+    printf("Configurations:  %zu\n", num_points);
+    printf("Trace instructions:  %zu\n", n_insts);
+
+    size_t divisor = PARETO_FIRST_PREFIX;
+    while (divisor > 1 && n_insts / divisor < PARETO_MIN_PREFIX) divisor /= 2;
+    size_t batch_insts = n_insts / divisor / PARETO_BATCHES;
+    if (batch_insts == 0) batch_insts = 1;
+    for (int round = 1; ; round++) {
+        size_t prefix = n_insts / divisor;
+
+        size_t num_alive = 0;
+        for (size_t i = 0; i < num_points; i++) {
+            if (!points[i].alive) continue;
+            if (advance_pareto_point(&points[i], prefix, batch_insts, margin) != 0) {
+                for (size_t j = 0; j < num_points; j++) finish_pareto_point(&points[j]);
+                free(points);
+                free(sorted);
+                return -1;
             }
-            cap_insts = new_cap_insts;
-            insts_arr = new_insts_arr;
-        }
-
-        inst_t *inst = insts_arr + size_insts;
-        // TODO: update traces to pc, opcode, dr, sr1, sr2, ldst, inst_num, mispred, icmiss, dcmiss
-        int mispred;
-        int ic_miss;
-        int dc_miss;
-        int ret = fscanf(trace, "%" SCNx64 " %d %" SCNd8 " %" SCNd8 " %" SCNd8 " %" SCNx64 " %" SCNu64 " %d %d %d\n", &inst->pc, (int *)&inst->opcode, &inst->dest, &inst->src1, &inst->src2, &inst->load_store_addr, &inst->dyn_instruction_count, &mispred, &ic_miss, &dc_miss);
-
-        if (ret == 10) {
-            inst->mispredict = mispred && sim_conf->misses_enabled;
-            inst->icache_miss = ic_miss && sim_conf->misses_enabled;
-            inst->dcache_miss = dc_miss && sim_conf->misses_enabled;
-            if (inst->dest == 0) inst->dest = -1;
-            size_insts++;
-        } else {
-            if (ferror(trace)) {
-                perror("fscanf");
-            } else {
-                fprintf(stderr, "could not parse line %d in trace (only %d input items matched). is it corrupt?\n", (int) size_insts, ret);
+            sorted[num_alive++] = &points[i];
+        }
+
+        // Walk the survivors in cost order (best IPC first among equal costs),
+        // dropping any that a configuration seen earlier in the walk dominates
+        qsort(sorted, num_alive, sizeof sorted[0], compare_pareto_cost);
+        size_t num_dropped = 0;
+        double best_ipc_lo = 0;
+        for (size_t i = 0; i < num_alive; i++) {
+            if (best_ipc_lo >= sorted[i]->ipc_hi) {
+                sorted[i]->alive = false;
+                finish_pareto_point(sorted[i]);
+                num_dropped++;
             }
-            goto error;
+            if (sorted[i]->ipc_lo > best_ipc_lo) best_ipc_lo = sorted[i]->ipc_lo;
         }
+        printf("Round %d: %zu configurations on %zu instructions, %zu dominated\n",
+               round, num_alive, prefix, num_dropped);
+
+        if (divisor == 1) {
+            break;
+        }
+        divisor /= 2;
     }
 
-    *size_insts_out = size_insts;
-    return insts_arr;
+    // Everything still alive after the full-trace round is on the frontier
+    printf("\nPARETO FRONTIER\n");
+    printf("Cost     F    P  S  A  M  L  IPC\n");
+    uint64_t simulated_insts = 0;
+    size_t num_alive = 0;
+    for (size_t i = 0; i < num_points; i++) {
+        finish_pareto_point(&points[i]);
+        simulated_insts += points[i].cursor.retired_inst_idx;
+        if (points[i].alive) sorted[num_alive++] = &points[i];
+    }
+    qsort(sorted, num_alive, sizeof sorted[0], compare_pareto_cost);
+    for (size_t i = 0; i < num_alive; i++) {
+        const procsim_conf_t *conf = &sorted[i]->conf;
+        printf("%-8.2f %-4zu %-4zu %-2zu %-2zu %-2zu %-2zu %.3f\n", sorted[i]->cost,
+               conf->fetch_width, conf->num_pregs, conf->num_schedq_entries_per_fu,
+               conf->num_alu_fus, conf->num_mul_fus, conf->num_lsu_fus, sorted[i]->ipc);
+    }
+    printf("\nSimulated instructions:  %" PRIu64 " (%.1f%% of an exhaustive sweep)\n",
+           simulated_insts, 100.0 * simulated_insts / ((double)num_points * n_insts));
 
-    error:
-    free(insts_arr);
-    *size_insts_out = 0;
-    return NULL;
+    free(points);
+    free(sorted);
+    return 0;
 }
 
-
-bool in_mispred = false;
-bool in_icache_miss = false;
-size_t icache_miss_ctr = 0;
-bool finished_miss = false;
-const inst_t *procsim_driver_read_inst(void) {
-    if (in_mispred) {
-        return NULL;
+// Loads the dependence annotations for the trace, (re)building the sidecar
+// when necessary. Returns 0 on success, -1 on error
+static int load_trace_deps(FILE *trace, const char *trace_path) {
+    uint64_t trace_hash;
+    if (trace_deps_hash_file(trace, &trace_hash) != 0) {
+        return -1;
     }
-    if (in_icache_miss) {
-        return NULL;
+    size_t path_len = strlen(trace_path) + sizeof ".deps";
+    char *deps_path = (char *)malloc(path_len);
+    if (deps_path == NULL) {
+        perror("malloc");
+        return -1;
     }
-    if (fetch_inst_idx >= n_insts) {
-        return NULL;
+    snprintf(deps_path, path_len, "%s.deps", trace_path);
+    bool built;
+    deps = trace_deps_load_or_build(deps_path, trace_hash, insts, n_insts, &built);
+    if (deps != NULL) {
+        printf("Dependence annotations %s %s\n", built ? "built into" : "loaded from", deps_path);
+    }
+    free(deps_path);
+    return deps != NULL ? 0 : -1;
+}
+
+// Prints the analytical estimates for the configuration and, when sim_stats
+// is not NULL, their error against the cycle-accurate result
+static void print_estimate(const estimate_t *est, const procsim_stats_t *sim_stats) {
+    printf("\nESTIMATE\n");
+    printf("Critical path:              %" PRIu64 "\n", est->critical_path);
+    printf("Upper-bound cycles:         %" PRIu64 "\n", est->upper_bound_cycles);
+    printf("Upper-bound IPC:            %.3f\n", est->upper_bound_ipc);
+    printf("Interval-analysis cycles:   %" PRIu64 "\n", est->interval_cycles);
+    printf("Interval-analysis IPC:      %.3f\n", est->interval_ipc);
+    if (sim_stats) {
+        printf("Cycle-accurate IPC:         %.3f\n", sim_stats->ipc);
+        printf("Upper-bound IPC error:      %+.2f%%\n",
+               100.0 * (est->upper_bound_ipc - sim_stats->ipc) / sim_stats->ipc);
+        printf("Interval-analysis IPC error: %+.2f%%\n",
+               100.0 * (est->interval_ipc - sim_stats->ipc) / sim_stats->ipc);
+    }
+}
+
+// One simulated core of a multi-core run
+typedef struct {
+    const char *trace_path;
+    inst_t *insts;
+    size_t n_insts;
+    trace_cursor_t cursor;
+    procsim_stats_t stats;
+    hotspot_table_t *hotspots;
+    bool done;
+    bool deadlocked;
+} sim_core_t;
+
+// Cores of a multi-core run, each simulated on its own host thread. The
+// threads meet at a barrier every quantum cycles, where the last one to
+// arrive syncs the shared L2 and checks whether every core is done.
+typedef struct {
+    const procsim_conf_t *conf;
+    sim_core_t *cores;
+    size_t num_cores;
+    uint64_t quantum;
+    shared_l2_t *l2;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t num_waiting;
+    uint64_t generation;
+    bool all_done;
+} multicore_t;
+
+/* wait for every core to finish the quantum.
+ * Returns false once all cores are done */
+static bool multicore_barrier(multicore_t *mc) {
+    std::unique_lock<std::mutex> guard(mc->lock);
+    uint64_t generation = mc->generation;
+    if (++mc->num_waiting == mc->num_cores) {
+        if (mc->l2 != NULL) {
+            shared_l2_sync(mc->l2);
+        }
+        mc->all_done = true;
+        for (size_t i = 0; i < mc->num_cores; i++) {
+            mc->all_done &= mc->cores[i].done;
+        }
+        mc->num_waiting = 0;
+        mc->generation++;
+        mc->cv.notify_all();
     } else {
-        if (insts[fetch_inst_idx].icache_miss) {
-            if (!finished_miss) { // if didnt just finish a cache miss
-                in_icache_miss = true;
-                icache_miss_ctr = L1_MISS_PENALTY;
-                finished_miss = false;
-                return NULL; // can't give you an instruction that missed in cache
-            } else {
-                finished_miss = false; // reset state for icache misses
-                // carry on to check other details
+        mc->cv.wait(guard, [&] { return mc->generation != generation; });
+    }
+    return !mc->all_done;
+}
+
+static void multicore_thread(multicore_t *mc, size_t core_id) {
+    sim_core_t *sc = &mc->cores[core_id];
+    trace_cursor_init(&sc->cursor, sc->insts, sc->n_insts);
+    trace_cursor_select(&sc->cursor);
+    procsim_init(mc->conf, &sc->stats);
+    if (mc->l2 != NULL) {
+        procsim_attach_shared_l2(mc->l2, core_id);
+    }
+    if (sc->hotspots != NULL) {
+        procsim_attach_hotspots(sc->hotspots);
+    }
+
+    do {
+        for (uint64_t c = 0; c < mc->quantum && !sc->done; c++) {
+            if (trace_cursor_cycle(&sc->stats) != 0) {
+                sc->deadlocked = true;
+            }
+            sc->done = sc->deadlocked || trace_cursor_done(&sc->cursor);
+        }
+    } while (multicore_barrier(mc));
+
+    sc->stats.instructions_in_trace = sc->n_insts;
+    procsim_finish(&sc->stats);
+}
+
+// Simulates every core to completion, one host thread per core. Returns 0
+// on success and -1 if any core deadlocked.
+static int run_multicore(multicore_t *mc) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < mc->num_cores; i++) {
+        threads.emplace_back(multicore_thread, mc, i);
+    }
+    int ret = 0;
+    for (size_t i = 0; i < mc->num_cores; i++) {
+        threads[i].join();
+        if (mc->cores[i].deadlocked) ret = -1;
+    }
+    return ret;
+}
+
+static void print_multicore_output(const multicore_t *mc) {
+    uint64_t cycles = 0;
+    uint64_t retired = 0;
+    double ipc_sum = 0;
+    for (size_t i = 0; i < mc->num_cores; i++) {
+        const procsim_stats_t *stats = &mc->cores[i].stats;
+        if (stats->cycles > cycles) cycles = stats->cycles;
+        retired += stats->instructions_retired;
+        ipc_sum += stats->ipc;
+    }
+    printf("\nMULTI-CORE OUTPUT\n");
+    printf("Cycles (slowest core):      %" PRIu64 "\n", cycles);
+    printf("Retired instructions:       %" PRIu64 "\n", retired);
+    printf("Throughput IPC:             %.3f\n", (double)retired / cycles);
+    printf("Sum of per-core IPC:        %.3f\n", ipc_sum);
+    if (mc->l2 != NULL) {
+        for (size_t i = 0; i < mc->num_cores; i++) {
+            const procsim_stats_t *stats = &mc->cores[i].stats;
+            printf("Core %zu L2 read misses:     %" PRIu64 " / %" PRIu64 "\n",
+                   i, stats->l2_read_misses, stats->l2_reads);
+        }
+    }
+}
+
+// One segment of a segmented run. Instructions [warm_start, start) only warm
+// up the pipeline; the stats cover [start, end)
+typedef struct {
+    size_t warm_start;
+    size_t start;
+    size_t end;
+    procsim_stats_t stats;
+    hotspot_table_t *hotspots;
+    bool deadlocked;
+} segment_t;
+
+static void segment_thread(const procsim_conf_t *sim_conf, segment_t *seg) {
+    trace_cursor_t c;
+    trace_cursor_init(&c, insts + seg->warm_start, seg->end - seg->warm_start);
+    trace_cursor_select(&c);
+    procsim_init(sim_conf, &seg->stats);
+    if (seg->hotspots != NULL) {
+        procsim_attach_hotspots(seg->hotspots);
+    }
+
+    size_t warm_len = seg->start - seg->warm_start;
+    bool measuring = warm_len == 0;
+    while (!trace_cursor_done(&c)) {
+        if (trace_cursor_cycle(&seg->stats) != 0) {
+            seg->deadlocked = true;
+            return;
+        }
+        if (!measuring && c.retired_inst_idx >= warm_len) {
+            // Start counting from the cycle the last warm-up instruction retired
+            memset(&seg->stats, 0, sizeof seg->stats);
+            seg->stats.instructions_retired = c.retired_inst_idx - warm_len;
+            seg->stats.instructions_fetched = c.fetch_inst_idx - warm_len;
+            if (seg->hotspots != NULL) {
+                hotspot_clear(seg->hotspots);
             }
+            measuring = true;
+        }
+    }
+    procsim_finish(&seg->stats);
+}
+
+/* sum the segments' stats into *sim_stats and finalize them */
+static void stitch_segments(const segment_t *segs, size_t num_segs, procsim_stats_t *sim_stats) {
+    double dispq_sum = 0, schedq_sum = 0, rob_sum = 0;
+    for (size_t i = 0; i < num_segs; i++) {
+        const procsim_stats_t *s = &segs[i].stats;
+        sim_stats->cycles += s->cycles;
+        sim_stats->instructions_fetched += s->instructions_fetched;
+        sim_stats->instructions_retired += s->instructions_retired;
+        sim_stats->branch_mispredictions += s->branch_mispredictions;
+        sim_stats->icache_misses += s->icache_misses;
+        sim_stats->reads += s->reads;
+        sim_stats->store_buffer_read_hits += s->store_buffer_read_hits;
+        sim_stats->dcache_reads += s->dcache_reads;
+        sim_stats->dcache_read_misses += s->dcache_read_misses;
+        sim_stats->dcache_read_hits += s->dcache_read_hits;
+        sim_stats->l2_reads += s->l2_reads;
+        sim_stats->l2_read_misses += s->l2_read_misses;
+        sim_stats->l2_read_cycles += s->l2_read_cycles;
+        sim_stats->l2_queue_cycles += s->l2_queue_cycles;
+        sim_stats->dram_read_cycles += s->dram_read_cycles;
+        sim_stats->dram_queue_cycles += s->dram_queue_cycles;
+        sim_stats->no_dispatch_pregs_cycles += s->no_dispatch_pregs_cycles;
+        sim_stats->rob_stall_cycles += s->rob_stall_cycles;
+        sim_stats->dispq_full_cycles += s->dispq_full_cycles;
+        sim_stats->mshr_merged_reads += s->mshr_merged_reads;
+        sim_stats->mshr_full_cycles += s->mshr_full_cycles;
+        sim_stats->prefetches_issued += s->prefetches_issued;
+        sim_stats->prefetch_hits += s->prefetch_hits;
+        sim_stats->prefetch_late_hits += s->prefetch_late_hits;
+        sim_stats->speculative_loads += s->speculative_loads;
+        sim_stats->memory_violations += s->memory_violations;
+        sim_stats->memory_squashes += s->memory_squashes;
+        sim_stats->replayed_instructions += s->replayed_instructions;
+        sim_stats->mispredict_recovery_cycles += s->mispredict_recovery_cycles;
+        sim_stats->no_fire_cycles += s->no_fire_cycles;
+        for (int c = 0; c < NUM_CPI_CATEGORIES; c++) {
+            sim_stats->cpi_slots[c] += s->cpi_slots[c];
+        }
+        for (int op = 0; op < NUM_OPCODES; op++) {
+            for (int k = 0; k < NUM_LATENCY_KINDS; k++) {
+                for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                    sim_stats->latency_hist[op][k][b] += s->latency_hist[op][k][b];
+                }
+                if (s->latency_max[op][k] > sim_stats->latency_max[op][k]) {
+                    sim_stats->latency_max[op][k] = s->latency_max[op][k];
+                }
+            }
+        }
+        if (s->dispq_max_size > sim_stats->dispq_max_size) sim_stats->dispq_max_size = s->dispq_max_size;
+        if (s->schedq_max_size > sim_stats->schedq_max_size) sim_stats->schedq_max_size = s->schedq_max_size;
+        if (s->rob_max_size > sim_stats->rob_max_size) sim_stats->rob_max_size = s->rob_max_size;
+        // Undo procsim_finish()'s division so the sums can be re-averaged
+        dispq_sum += s->dispq_avg_size * s->cycles;
+        schedq_sum += s->schedq_avg_size * s->cycles;
+        rob_sum += s->rob_avg_size * s->cycles;
+    }
+    sim_stats->dispq_avg_size = dispq_sum;
+    sim_stats->schedq_avg_size = schedq_sum;
+    sim_stats->rob_avg_size = rob_sum;
+    procsim_finalize_stats(sim_stats);
+}
+
+// Splits the loaded trace into num_segs segments, simulates each on its own
+// host thread after warming it up on the warmup instructions before it, and
+// stitches the results into *sim_stats. Pipeline state at each boundary is
+// only approximated by the warm-up, but the branch predictor has already run
+// over the whole trace, so mispredicts are exact. Returns 0 on success and -1
+// on a deadlock.
+static int run_segmented(const procsim_conf_t *sim_conf, procsim_stats_t *sim_stats,
+                         size_t num_segs, size_t warmup) {
+    segment_t *segs = (segment_t *)calloc(num_segs, sizeof(segment_t));
+    if (segs == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_segs; i++) {
+        segs[i].start = n_insts * i / num_segs;
+        segs[i].end = n_insts * (i + 1) / num_segs;
+        segs[i].warm_start = segs[i].start > warmup ? segs[i].start - warmup : 0;
+        if (hotspots != NULL && (segs[i].hotspots = hotspot_create()) == NULL) {
+            perror("hotspot_create");
+            segs[i].deadlocked = true;
+            continue;
+        }
+        threads.emplace_back(segment_thread, sim_conf, &segs[i]);
+    }
+    int ret = 0;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < num_segs; i++) {
+        if (segs[i].deadlocked) ret = -1;
+    }
+    if (ret == 0) {
+        stitch_segments(segs, num_segs, sim_stats);
+        sim_stats->instructions_in_trace = n_insts;
+        for (size_t i = 0; i < num_segs && hotspots != NULL; i++) {
+            if (hotspot_merge(hotspots, segs[i].hotspots) != 0) {
+                perror("hotspot_merge");
+                ret = -1;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < num_segs; i++) {
+        hotspot_destroy(segs[i].hotspots);
+    }
+    free(segs);
+    return ret;
+}
+
+/* signed relative error of a segmented result against the serial one, in % */
+static double divergence(double segmented, double serial) {
+    return serial != 0 ? 100.0 * (segmented - serial) / serial : 0;
+}
+
+// State of an early-terminated run
+typedef struct {
+    double precision;        // Target half-width of the interval, relative to the IPC
+    uint64_t batch_cycles;
+    size_t num_batches;
+    double half_width;       // Of the 95% confidence interval of the IPC
+    size_t insts_simulated;
+    bool converged;
+} early_term_t;
+
+// Simulates the loaded trace until the IPC is known to the requested
+// precision, or to its end. Each batch of batch_cycles cycles gives one IPC
+// sample, and the batch means method takes the samples as independent, which
+// holds when batches are long compared to the pipeline's memory. Returns 0
+// on success and -1 on a deadlock.
+static int run_early_terminated(procsim_conf_t *sim_conf, procsim_stats_t *sim_stats,
+                                early_term_t *et, hotspot_table_t *profile) {
+    trace_cursor_t c;
+    trace_cursor_init(&c, insts, n_insts);
+    trace_cursor_select(&c);
+    procsim_init(sim_conf, sim_stats);
+    if (profile != NULL) {
+        procsim_attach_hotspots(profile);
+    }
+
+    double sum = 0, sum_sq = 0;
+    uint64_t batch_start = 0;
+    while (!trace_cursor_done(&c)) {
+        if (trace_cursor_cycle(sim_stats) != 0) {
+            return -1;
+        }
+        if (sim_stats->cycles % et->batch_cycles != 0) {
+            continue;
+        }
+        double ipc = (double)(sim_stats->instructions_retired - batch_start) / et->batch_cycles;
+        batch_start = sim_stats->instructions_retired;
+        sum += ipc;
+        sum_sq += ipc * ipc;
+        size_t n = ++et->num_batches;
+        if (n < 2) {
+            continue;
+        }
+        double mean = sum / n;
+        double var = (sum_sq - n * mean * mean) / (n - 1);
+        et->half_width = t_critical_95(n - 1) * sqrt(var > 0 ? var / n : 0);
+        if (n >= EARLY_MIN_BATCHES && et->half_width <= et->precision * mean) {
+            et->converged = true;
+            break;
+        }
+    }
+    et->insts_simulated = c.retired_inst_idx;
+    sim_stats->instructions_in_trace = n_insts;
+    procsim_finish(sim_stats);
+    return 0;
+}
+
+static void print_early_termination(const early_term_t *et, const procsim_stats_t *sim_stats) {
+    double scale = et->insts_simulated ? (double)n_insts / et->insts_simulated : 1;
+    printf("\nEARLY TERMINATION\n");
+    printf("Converged:                  %s\n", et->converged ? "yes" : "no, ran the whole trace");
+    printf("IPC estimate:               %.3f +/- %.3f (95%% confidence)\n",
+           sim_stats->ipc, et->half_width);
+    printf("Batches:                    %zu of %" PRIu64 " cycles\n", et->num_batches, et->batch_cycles);
+    printf("Fraction simulated:         %.2f%% (%zu of %zu instructions)\n",
+           100.0 * et->insts_simulated / n_insts, et->insts_simulated, n_insts);
+    printf("Extrapolated cycles:        %.0f\n", sim_stats->cycles * scale);
+    printf("Extrapolated I-Cache misses: %.0f\n", sim_stats->icache_misses * scale);
+    printf("Extrapolated D-Cache read misses: %.0f\n", sim_stats->dcache_read_misses * scale);
+    printf("Extrapolated Branch Mispredictions: %.0f\n", sim_stats->branch_mispredictions * scale);
+}
+
+static void print_memoization(const memo_report_t *report, const procsim_stats_t *sim_stats) {
+    printf("\nMEMOIZATION\n");
+    printf("Skipped spans:              %" PRIu64 "\n", report->spans);
+    printf("Skipped instructions:       %" PRIu64 " (%.2f%%)\n", report->skipped_insts,
+           100.0 * report->skipped_insts / sim_stats->instructions_retired);
+    printf("Skipped cycles:             %" PRIu64 "\n", report->skipped_cycles);
+    printf("Verified spans:             %" PRIu64 ", max cycle error %.3f%%\n",
+           report->verified_spans, 100 * report->max_error);
+    if (report->disabled) {
+        printf("Stopped skipping:           cycle error above %.3f%%\n", 100 * MEMO_MAX_ERROR);
+    }
+}
+
+/* print the fields in which the snapshots of procsim.cpp and the reference
+ * model differ */
+static void print_snapshot_diff(const procsim_snapshot_t *fast, const procsim_snapshot_t *ref,
+                                size_t num_regs) {
+    const struct {
+        const char *name;
+        size_t fast, ref;
+    } sizes[] = {
+        {"DispQ size", fast->dispq_size, ref->dispq_size},
+        {"SchedQ size", fast->schedq_size, ref->schedq_size},
+        {"ROB size", fast->rob_size, ref->rob_size},
+        {"Store buffer size", fast->stb_size, ref->stb_size},
+    };
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        if (sizes[i].fast != sizes[i].ref) {
+            printf("%-20s %10zu %10zu\n", sizes[i].name, sizes[i].fast, sizes[i].ref);
+        }
+    }
+    char label[32], fast_preg[32], ref_preg[32];
+    for (size_t r = 0; r < NUM_REGS; r++) {
+        if (fast->rat[r] != ref->rat[r]) {
+            snprintf(label, sizeof label, "RAT R%02zu", r);
+            snprintf(fast_preg, sizeof fast_preg, "P%lu", fast->rat[r]);
+            snprintf(ref_preg, sizeof ref_preg, "P%lu", ref->rat[r]);
+            printf("%-20s %10s %10s\n", label, fast_preg, ref_preg);
+        }
+    }
+    for (size_t p = 0; p < num_regs; p++) {
+        if (fast->ready[p] != ref->ready[p]) {
+            snprintf(label, sizeof label, "P%zu ready", p);
+            printf("%-20s %10d %10d\n", label, fast->ready[p], ref->ready[p]);
+        }
+        if (fast->free[p] != ref->free[p]) {
+            snprintf(label, sizeof label, "P%zu free", p);
+            printf("%-20s %10d %10d\n", label, fast->free[p], ref->free[p]);
+        }
+    }
+}
+
+static bool snapshots_equal(const procsim_snapshot_t *a, const procsim_snapshot_t *b,
+                            size_t num_regs) {
+    return a->dispq_size == b->dispq_size && a->schedq_size == b->schedq_size &&
+        a->rob_size == b->rob_size && a->stb_size == b->stb_size &&
+        memcmp(a->rat, b->rat, sizeof a->rat) == 0 &&
+        memcmp(a->ready, b->ready, num_regs * sizeof(bool)) == 0 &&
+        memcmp(a->free, b->free, num_regs * sizeof(bool)) == 0;
+}
+
+// Simulates the loaded trace on procsim.cpp and on the reference model (see
+// procsim_ref.hpp) side by side, one cycle at a time, comparing the
+// instructions and mispredictions they retired and their pipeline state after
+// every cycle. Fills in *sim_stats from procsim.cpp. Returns 0 if the two
+// never differed, 1 after reporting the first cycle in which they did, and -1
+// on a deadlock or allocation failure.
+static int run_reference_diff(const procsim_conf_t *sim_conf, procsim_stats_t *sim_stats) {
+    size_t num_regs = NUM_REGS + sim_conf->num_pregs;
+    bool *bits = (bool *)calloc(4 * num_regs, sizeof(bool));
+    if (bits == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    procsim_snapshot_t fast, ref;
+    fast.ready = bits;
+    fast.free = bits + num_regs;
+    ref.ready = bits + 2 * num_regs;
+    ref.free = bits + 3 * num_regs;
+
+    procsim_stats_t ref_stats;
+    memset(&ref_stats, 0, sizeof ref_stats);
+    trace_cursor_t fast_cursor, ref_cursor;
+    trace_cursor_init(&fast_cursor, insts, n_insts);
+    trace_cursor_init(&ref_cursor, insts, n_insts);
+    trace_cursor_select(&fast_cursor);
+    procsim_init(sim_conf, sim_stats);
+    trace_cursor_select(&ref_cursor);
+    procsim_ref_init(sim_conf, &ref_stats);
+
+    int ret = 0;
+    while (!trace_cursor_done(&fast_cursor)) {
+        uint64_t cycle = sim_stats->cycles;
+        trace_cursor_select(&fast_cursor);
+        if (trace_cursor_cycle(sim_stats) != 0) {
+            ret = -1;
+            break;
         }
-        if (insts[fetch_inst_idx].mispredict) {
-            in_mispred = true;
+        trace_cursor_select(&ref_cursor);
+        if (trace_cursor_cycle_with(procsim_ref_do_cycle, &ref_stats) != 0) {
+            ret = -1;
+            break;
+        }
+        procsim_snapshot(&fast);
+        procsim_ref_snapshot(&ref);
+        if (fast_cursor.retired_inst_idx == ref_cursor.retired_inst_idx &&
+                sim_stats->branch_mispredictions == ref_stats.branch_mispredictions &&
+                snapshots_equal(&fast, &ref, num_regs)) {
+            continue;
+        }
+
+        printf("\nDIVERGENCE at cycle %" PRIu64 "\n", cycle);
+        printf("%-20s %10s %10s\n", "", "procsim", "reference");
+        printf("%-20s %10" PRIu64 " %10" PRIu64 "\n", "Retired",
+               fast_cursor.retired_inst_idx, ref_cursor.retired_inst_idx);
+        printf("%-20s %10" PRIu64 " %10" PRIu64 "\n", "Mispredicts retired",
+               sim_stats->branch_mispredictions, ref_stats.branch_mispredictions);
+        print_snapshot_diff(&fast, &ref, num_regs);
+        ret = 1;
+        break;
+    }
+
+    sim_stats->instructions_in_trace = n_insts;
+    ref_stats.instructions_in_trace = n_insts;
+    procsim_finish(sim_stats);
+    procsim_ref_finish(&ref_stats);
+    free(bits);
+    return ret;
+}
+
+static void print_segment_check(const procsim_stats_t *seg_stats, const procsim_stats_t *serial) {
+    printf("\nSEGMENTED VS SERIAL\n");
+    printf("Serial cycles:              %" PRIu64 "\n", serial->cycles);
+    printf("Serial IPC:                 %.3f\n", serial->ipc);
+    printf("Cycles divergence:          %+.2f%%\n", divergence(seg_stats->cycles, serial->cycles));
+    printf("IPC divergence:             %+.2f%%\n", divergence(seg_stats->ipc, serial->ipc));
+    printf("Average ROB usage divergence: %+.2f%%\n",
+           divergence(seg_stats->rob_avg_size, serial->rob_avg_size));
+    printf("Cycles with no fires divergence: %+.2f%%\n",
+           divergence(seg_stats->no_fire_cycles, serial->no_fire_cycles));
+}
+
+// Runs each trace on its own core. Returns the process exit status
+static int multicore_main(const char *const *trace_paths, size_t num_traces,
+                          procsim_conf_t *sim_conf, uint64_t quantum,
+                          size_t shared_l2_kib, bool host_timing, bool cpi_stack, bool latency,
+                          size_t hotspot_n) {
+    multicore_t *mc = new multicore_t();
+    mc->conf = sim_conf;
+    mc->num_cores = num_traces;
+    mc->quantum = quantum;
+    mc->cores = (sim_core_t *)calloc(num_traces, sizeof(sim_core_t));
+    int ret = 1;
+    for (size_t i = 0; i < num_traces; i++) {
+        sim_core_t *sc = &mc->cores[i];
+        sc->trace_path = trace_paths[i];
+        FILE *trace = fopen(trace_paths[i], "r");
+        if (trace == NULL) {
+            perror("fopen");
+            goto out;
+        }
+        sc->insts = trace_read(trace, &sc->n_insts, sim_conf);
+        fclose(trace);
+        if (!sc->insts || trace_apply_branch_predictor(sc->insts, sc->n_insts, sim_conf, &sc->stats) != 0) {
+            goto out;
+        }
+        if (hotspot_n && (sc->hotspots = hotspot_create()) == NULL) {
+            perror("hotspot_create");
+            goto out;
+        }
+    }
+    if (shared_l2_kib) {
+        mc->l2 = shared_l2_create(shared_l2_kib * 1024, SHARED_L2_ASSOC, num_traces);
+        if (mc->l2 == NULL) {
+            perror("shared_l2_create");
+            goto out;
+        }
+    }
+
+    print_sim_config(sim_conf);
+    printf("Cores:    %zu\n", num_traces);
+    printf("Quantum:  %" PRIu64 " cycles\n", quantum);
+    if (mc->l2 != NULL) {
+        printf("Shared L2:  %zu KiB, %d-way, %d cycle miss penalty\n",
+               shared_l2_kib, SHARED_L2_ASSOC, L2_MISS_PENALTY);
+    }
+    printf("SETUP COMPLETE - STARTING SIMULATION\n");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (run_multicore(mc) != 0) {
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (size_t i = 0; i < num_traces; i++) {
+        printf("\nCORE %zu: %s\n", i, mc->cores[i].trace_path);
+        print_sim_output(mc->conf, &mc->cores[i].stats);
+        if (cpi_stack) {
+            print_cpi_stack(&mc->cores[i].stats);
+        }
+        if (latency) {
+            print_latency_output(&mc->cores[i].stats);
+        }
+        if (hotspot_n) {
+            print_hotspots(mc->cores[i].hotspots, hotspot_n);
         }
-        return &insts[fetch_inst_idx++];
     }
+    print_multicore_output(mc);
+    if (host_timing) {
+        double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        printf("\nHOST TIMING\n");
+        printf("Simulation time:      %.3f ms\n", ns / 1e6);
+    }
+    ret = 0;
+
+out:
+    for (size_t i = 0; i < num_traces; i++) {
+        free(mc->cores[i].insts);
+        hotspot_destroy(mc->cores[i].hotspots);
+    }
+    free(mc->cores);
+    shared_l2_destroy(mc->l2);
+    delete mc;
+    return ret;
 }
 
 int main(int argc, char *const argv[])
 {
     FILE *trace = NULL;
+    const char *trace_path = NULL;
+    const char *trace_paths[MAX_CORES];
+    size_t num_traces = 0;
 
     procsim_stats_t sim_stats;
     memset(&sim_stats, 0, sizeof sim_stats);
 
     procsim_conf_t sim_conf;
-    memset(&sim_conf, 0, sizeof sim_conf);
-    // Default configuration
-    // TODO: this
-    sim_conf.num_pregs = 64;
-    sim_conf.num_rob_entries = 96;
-    sim_conf.num_schedq_entries_per_fu = 2;
-    sim_conf.num_alu_fus = 2;
-    sim_conf.num_mul_fus = 1;
-    sim_conf.num_lsu_fus = 2;
-    sim_conf.fetch_width = 2;
-    sim_conf.misses_enabled = true;
+    procsim_conf_default(&sim_conf);
+
+    bool pareto = false;
+    bool use_deps = false;
+    bool estimate = false;
+    bool estimate_check = false;
+    bool experimental = false;
+    bool host_timing = false;
+    bool latency = false;
+    bool cpi_stack = false;
+    size_t hotspot_n = 0;
+    early_term_t early_term;
+    memset(&early_term, 0, sizeof early_term);
+    early_term.batch_cycles = EARLY_DEFAULT_BATCH_CYCLES;
+    size_t rob_entries = 0;
+    uint64_t quantum = MULTICORE_DEFAULT_QUANTUM;
+    size_t shared_l2_kib = 0;
+    size_t num_segments = 0;
+    size_t warmup = SEGMENT_DEFAULT_WARMUP;
+    bool segments_check = false;
+    const char *cache_dir = NULL;
+    double pareto_margin = PARETO_DEFAULT_MARGIN;
+    bool memoize = false;
+    bool diff_ref = false;
+    bool redirect_penalty_given = false;
+    bool serve = false;
+    const char *socket_path = NULL;
+    size_t serve_threads = 0;
+    memo_report_t memo_report;
+
+    static const struct option long_opts[] = {
+        {"pareto", no_argument, NULL, OPT_PARETO},
+        {"pareto-margin", required_argument, NULL, OPT_PARETO_MARGIN},
+        {"deps", no_argument, NULL, OPT_DEPS},
+        {"estimate", no_argument, NULL, OPT_ESTIMATE},
+        {"estimate-check", no_argument, NULL, OPT_ESTIMATE_CHECK},
+        {"experimental", no_argument, NULL, OPT_EXPERIMENTAL},
+        {"host-timing", no_argument, NULL, OPT_HOST_TIMING},
+        {"quantum", required_argument, NULL, OPT_QUANTUM},
+        {"shared-l2", required_argument, NULL, OPT_SHARED_L2},
+        {"segments", required_argument, NULL, OPT_SEGMENTS},
+        {"warmup", required_argument, NULL, OPT_WARMUP},
+        {"segments-check", no_argument, NULL, OPT_SEGMENTS_CHECK},
+        {"cache", no_argument, NULL, OPT_CACHE},
+        {"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+        {"latency", no_argument, NULL, OPT_LATENCY},
+        {"cpi-stack", no_argument, NULL, OPT_CPI_STACK},
+        {"hotspots", required_argument, NULL, OPT_HOTSPOTS},
+        {"precision", required_argument, NULL, OPT_PRECISION},
+        {"memoize", no_argument, NULL, OPT_MEMOIZE},
+        {"diff-ref", no_argument, NULL, OPT_DIFF_REF},
+        {"serve", no_argument, NULL, OPT_SERVE},
+        {"socket", required_argument, NULL, OPT_SOCKET},
+        {"serve-threads", required_argument, NULL, OPT_SERVE_THREADS},
+        {"batch-cycles", required_argument, NULL, OPT_BATCH_CYCLES},
+        {"mshrs", required_argument, NULL, OPT_MSHRS},
+        {"l2", required_argument, NULL, OPT_L2},
+        {"l2-assoc", required_argument, NULL, OPT_L2_ASSOC},
+        {"l2-latency", required_argument, NULL, OPT_L2_LATENCY},
+        {"l2-banks", required_argument, NULL, OPT_L2_BANKS},
+        {"dram-latency", required_argument, NULL, OPT_DRAM_LATENCY},
+        {"dram-banks", required_argument, NULL, OPT_DRAM_BANKS},
+        {"dram-bank-busy", required_argument, NULL, OPT_DRAM_BANK_BUSY},
+        {"prefetch", required_argument, NULL, OPT_PREFETCH},
+        {"prefetch-degree", required_argument, NULL, OPT_PREFETCH_DEGREE},
+        {"disambig", required_argument, NULL, OPT_DISAMBIG},
+        {"early-recovery", no_argument, NULL, OPT_EARLY_RECOVERY},
+        {"redirect-penalty", required_argument, NULL, OPT_REDIRECT_PENALTY},
+        {NULL, 0, NULL, 0},
+    };
 
     int opt;
-    while (-1 != (opt = getopt(argc, argv, "i:I:s:S:a:A:m:M:l:L:f:F:p:P:dDhH"))) {
+    while (-1 != (opt = getopt_long(argc, argv, "i:I:s:S:a:A:m:M:l:L:f:F:p:P:r:R:q:Q:b:B:dDhH", long_opts, NULL))) {
         switch (opt) {
             case 'i':
             case 'I':
-                trace = fopen(optarg, "r");
-                if (trace == NULL) {
-                    perror("fopen");
-                    print_err_usage("Could not open the input trace file");
+                if (num_traces == MAX_CORES) {
+                    print_err_usage("Too many trace files");
                 }
+                trace_paths[num_traces++] = optarg;
                 break;
 
             case 's':
@@ -249,11 +1465,219 @@ int main(int argc, char *const argv[])
                 sim_conf.num_rob_entries = sim_conf.num_pregs + 32;
                 break;
 
+            case 'r':
+            case 'R':
+                rob_entries = atoi(optarg);
+                break;
+
+            case 'q':
+            case 'Q':
+                if (!parse_count(optarg, MAX_DISPQ_ENTRIES, &sim_conf.num_dispq_entries)) {
+                    print_err_usage("Invalid number of DispQ entries");
+                }
+                break;
+
             case 'd':
             case 'D':
                 sim_conf.misses_enabled = false;
                 break;
 
+            case 'b':
+            case 'B':
+                if (bpred_parse_kind(optarg, &sim_conf.branch_predictor) != 0) {
+                    print_err_usage("Unknown branch predictor");
+                }
+                break;
+
+            case OPT_PARETO:
+                pareto = true;
+                break;
+
+            case OPT_PARETO_MARGIN:
+                if (!parse_fraction(optarg, &pareto_margin)) {
+                    print_err_usage("--pareto-margin must be a fraction from 0 up to 1");
+                }
+                break;
+
+            case OPT_DEPS:
+                use_deps = true;
+                break;
+
+            case OPT_ESTIMATE:
+                estimate = true;
+                break;
+
+            case OPT_ESTIMATE_CHECK:
+                estimate = true;
+                estimate_check = true;
+                break;
+
+            case OPT_EXPERIMENTAL:
+                experimental = true;
+                break;
+
+            case OPT_HOST_TIMING:
+                host_timing = true;
+                break;
+
+            case OPT_QUANTUM: {
+                size_t v;
+                if (!parse_count(optarg, MAX_QUANTUM, &v) || v == 0) {
+                    print_err_usage("Invalid quantum");
+                }
+                quantum = v;
+                break;
+            }
+
+            case OPT_SHARED_L2:
+                if (!parse_count(optarg, MEMORY_MAX_L2_KIB, &shared_l2_kib) || shared_l2_kib == 0) {
+                    print_err_usage("Invalid shared L2 size");
+                }
+                break;
+
+            case OPT_SEGMENTS:
+                if (!parse_count(optarg, MAX_SEGMENTS, &num_segments) || num_segments == 0) {
+                    print_err_usage("Invalid number of segments");
+                }
+                break;
+
+            case OPT_WARMUP:
+                if (!parse_count(optarg, SIZE_MAX, &warmup)) {
+                    print_err_usage("Invalid number of warm-up instructions");
+                }
+                break;
+
+            case OPT_SEGMENTS_CHECK:
+                segments_check = true;
+                break;
+
+            case OPT_CACHE:
+                if (cache_dir == NULL) cache_dir = RESULT_CACHE_DEFAULT_DIR;
+                break;
+
+            case OPT_CACHE_DIR:
+                cache_dir = optarg;
+                break;
+
+            case OPT_LATENCY:
+                latency = true;
+                sim_conf.latency_histograms = true;
+                break;
+
+            case OPT_CPI_STACK:
+                cpi_stack = true;
+                break;
+
+            case OPT_HOTSPOTS:
+                if (!parse_count(optarg, MAX_HOTSPOTS, &hotspot_n) || hotspot_n == 0) {
+                    print_err_usage("--hotspots takes the number of PCs to print");
+                }
+                break;
+
+            case OPT_MSHRS:
+                if (!parse_count(optarg, MAX_MSHRS, &sim_conf.num_mshrs)) {
+                    print_err_usage("Invalid number of MSHRs");
+                }
+                break;
+
+            case OPT_PREFETCH:
+                if (prefetch_parse_kind(optarg, &sim_conf.prefetcher) != 0) {
+                    print_err_usage("Unknown prefetcher");
+                }
+                break;
+
+            case OPT_PREFETCH_DEGREE:
+                if (!parse_count(optarg, PREFETCH_MAX_DEGREE, &sim_conf.prefetch_degree) ||
+                        sim_conf.prefetch_degree == 0) {
+                    print_err_usage("Invalid prefetch degree");
+                }
+                break;
+
+            case OPT_EARLY_RECOVERY:
+                sim_conf.early_recovery = true;
+                break;
+
+            case OPT_REDIRECT_PENALTY:
+                if (!parse_count(optarg, MAX_REDIRECT_PENALTY, &sim_conf.redirect_penalty)) {
+                    print_err_usage("Invalid redirect penalty");
+                }
+                redirect_penalty_given = true;
+                break;
+
+            case OPT_DISAMBIG:
+                if (disambig_parse_policy(optarg, &sim_conf.disambig_policy) != 0) {
+                    print_err_usage("Unknown disambiguation policy");
+                }
+                break;
+
+            case OPT_L2:
+                if (!parse_count(optarg, MEMORY_MAX_L2_KIB, &sim_conf.l2_size_kib) ||
+                        sim_conf.l2_size_kib == 0) {
+                    print_err_usage("Invalid L2 size");
+                }
+                break;
+
+            case OPT_L2_ASSOC:
+            case OPT_L2_LATENCY:
+            case OPT_L2_BANKS:
+            case OPT_DRAM_LATENCY:
+            case OPT_DRAM_BANKS:
+            case OPT_DRAM_BANK_BUSY: {
+                size_t max = opt == OPT_L2_ASSOC ? MEMORY_MAX_L2_ASSOC
+                             : opt == OPT_L2_BANKS || opt == OPT_DRAM_BANKS ? MEMORY_MAX_BANKS
+                             : MEMORY_MAX_LATENCY;
+                size_t v;
+                if (!parse_count(optarg, max, &v) || v == 0) {
+                    print_err_usage("Invalid L2 or DRAM option");
+                }
+                switch (opt) {
+                    case OPT_L2_ASSOC: sim_conf.l2_assoc = v; break;
+                    case OPT_L2_LATENCY: sim_conf.l2_latency = v; break;
+                    case OPT_L2_BANKS: sim_conf.l2_banks = v; break;
+                    case OPT_DRAM_LATENCY: sim_conf.dram_latency = v; break;
+                    case OPT_DRAM_BANKS: sim_conf.dram_banks = v; break;
+                    default: sim_conf.dram_bank_busy = v; break;
+                }
+                break;
+            }
+
+            case OPT_MEMOIZE:
+                memoize = true;
+                break;
+
+            case OPT_DIFF_REF:
+                diff_ref = true;
+                break;
+
+            case OPT_SERVE:
+                serve = true;
+                break;
+
+            case OPT_SOCKET:
+                socket_path = optarg;
+                break;
+
+            case OPT_SERVE_THREADS:
+                if (!parse_count(optarg, MAX_SERVE_THREADS, &serve_threads) || serve_threads == 0) {
+                    print_err_usage("Invalid number of server threads");
+                }
+                break;
+
+            case OPT_PRECISION:
+                if (!parse_fraction(optarg, &early_term.precision) || early_term.precision == 0) {
+                    print_err_usage("--precision must be a fraction above 0 and below 1");
+                }
+                break;
+
+            case OPT_BATCH_CYCLES: {
+                size_t v;
+                if (!parse_count(optarg, EARLY_MAX_BATCH_CYCLES, &v) || v == 0) {
+                    print_err_usage("--batch-cycles must be a positive number of cycles");
+                }
+                early_term.batch_cycles = v;
+                break;
+            }
+
             case 'h':
             case 'H':
                 print_err_usage("");
@@ -265,72 +1689,252 @@ int main(int argc, char *const argv[])
         }
     }
 
-    if (!trace) {
+    if (num_traces == 0) {
         print_err_usage("No trace file provided!");
     }
-    if (!validate_sim_config(&sim_conf)) {
+    if (rob_entries) {
+        if (!experimental) {
+            print_err_usage("-R requires --experimental");
+        }
+        sim_conf.num_rob_entries = rob_entries;
+    }
+    if (sim_conf.l2_size_kib) {
+        if (shared_l2_kib) {
+            print_err_usage("--l2 cannot be combined with --shared-l2");
+        }
+        if (!sim_conf.l2_assoc) sim_conf.l2_assoc = MEMORY_DEFAULT_L2_ASSOC;
+        if (!sim_conf.l2_latency) sim_conf.l2_latency = MEMORY_DEFAULT_L2_LATENCY;
+        if (!sim_conf.l2_banks) sim_conf.l2_banks = MEMORY_DEFAULT_L2_BANKS;
+        if (!sim_conf.dram_latency) sim_conf.dram_latency = MEMORY_DEFAULT_DRAM_LATENCY;
+        if (!sim_conf.dram_banks) sim_conf.dram_banks = MEMORY_DEFAULT_DRAM_BANKS;
+        if (!sim_conf.dram_bank_busy) sim_conf.dram_bank_busy = MEMORY_DEFAULT_DRAM_BANK_BUSY;
+    } else if (sim_conf.l2_assoc || sim_conf.l2_latency || sim_conf.l2_banks ||
+               sim_conf.dram_latency || sim_conf.dram_banks || sim_conf.dram_bank_busy) {
+        print_err_usage("The L2 and DRAM options require --l2");
+    }
+    if (sim_conf.prefetcher != PREFETCH_NONE) {
+        if (!sim_conf.prefetch_degree) sim_conf.prefetch_degree = PREFETCH_DEFAULT_DEGREE;
+    } else if (sim_conf.prefetch_degree) {
+        print_err_usage("--prefetch-degree requires --prefetch");
+    }
+    if (redirect_penalty_given && !sim_conf.early_recovery) {
+        print_err_usage("--redirect-penalty requires --early-recovery");
+    }
+    if (segments_check && !num_segments) {
+        print_err_usage("--segments-check requires --segments");
+    }
+    if (num_segments && (pareto || estimate)) {
+        print_err_usage("--segments cannot be combined with --pareto or --estimate");
+    }
+    if (early_term.precision && (num_segments || pareto || estimate)) {
+        print_err_usage("--precision cannot be combined with --segments, --pareto or --estimate");
+    }
+    if (memoize && (num_segments || pareto || early_term.precision || hotspot_n ||
+                    num_traces > 1)) {
+        print_err_usage("--memoize cannot be combined with --segments, --pareto, --precision,\n"
+                        "--hotspots or several traces");
+    }
+    if (memoize && (sim_conf.num_mshrs || sim_conf.l2_size_kib || shared_l2_kib ||
+                    sim_conf.prefetcher != PREFETCH_NONE ||
+                    sim_conf.disambig_policy != DISAMBIG_CONSERVATIVE)) {
+        print_err_usage("--memoize cannot model MSHRs, an L2, prefetching or speculative\n"
+                        "disambiguation");
+    }
+    if (diff_ref && (num_segments || pareto || estimate || early_term.precision || memoize ||
+                     hotspot_n || num_traces > 1)) {
+        print_err_usage("--diff-ref cannot be combined with --segments, --pareto, --estimate,\n"
+                        "--precision, --memoize, --hotspots or several traces");
+    }
+    if (diff_ref && (rob_entries || sim_conf.num_dispq_entries || sim_conf.num_mshrs ||
+                     sim_conf.l2_size_kib || shared_l2_kib ||
+                     sim_conf.prefetcher != PREFETCH_NONE ||
+                     sim_conf.disambig_policy != DISAMBIG_CONSERVATIVE ||
+                     sim_conf.early_recovery)) {
+        print_err_usage("The reference model for --diff-ref has no -R, -Q, MSHRs, L2,\n"
+                        "prefetching, speculative disambiguation or early recovery");
+    }
+    if ((socket_path || serve_threads) && !serve) {
+        print_err_usage("--socket and --serve-threads require --serve");
+    }
+    if (serve) {
+        if (!serve_threads) {
+            serve_threads = std::min((size_t)MAX_SERVE_THREADS,
+                                     (size_t)std::max(1u, std::thread::hardware_concurrency()));
+        }
+        return serve_main(trace_paths, num_traces, &sim_conf, socket_path, serve_threads) ? 1 : 0;
+    }
+    if (num_traces > 1) {
+        if (pareto || estimate || use_deps || num_segments || early_term.precision) {
+            print_err_usage("--pareto, --estimate, --deps, --segments and --precision take a single trace");
+        }
+        if (!validate_sim_config(&sim_conf, experimental)) {
+            exit(EXIT_FAILURE);
+        }
+        return multicore_main(trace_paths, num_traces, &sim_conf, quantum,
+                              shared_l2_kib, host_timing, cpi_stack, latency,
+                              hotspot_n);
+    }
+
+    trace_path = trace_paths[0];
+    trace = fopen(trace_path, "r");
+    if (trace == NULL) {
+        perror("fopen");
+        print_err_usage("Could not open the input trace file");
+    }
+    if (!pareto && !validate_sim_config(&sim_conf, experimental)) {
         fclose(trace);
         exit(EXIT_FAILURE);
     }
 
-    insts = read_entire_trace(trace, &n_insts, &sim_conf);
+    // Only plain runs are cached; the other modes print more than the stats
+    uint64_t cache_key = 0;
+    if (cache_dir && (pareto || estimate || num_segments || use_deps || hotspot_n ||
+                      early_term.precision || memoize || diff_ref)) {
+        cache_dir = NULL;
+    }
+    if (cache_dir) {
+        uint64_t trace_hash;
+        if (trace_deps_hash_file(trace, &trace_hash) != 0) {
+            fclose(trace);
+            return 1;
+        }
+        cache_key = result_cache_key(trace_hash, &sim_conf);
+        if (result_cache_load(cache_dir, cache_key, &sim_stats) == 0) {
+            fclose(trace);
+            fprintf(stderr, "Using cached result %016" PRIx64 " from %s\n", cache_key, cache_dir);
+            print_sim_config(&sim_conf);
+            printf("SETUP COMPLETE - STARTING SIMULATION\n");
+            print_sim_output(&sim_conf, &sim_stats);
+            if (cpi_stack) {
+                print_cpi_stack(&sim_stats);
+            }
+            if (latency) {
+                print_latency_output(&sim_stats);
+            }
+            return 0;
+        }
+    }
+
+    insts = trace_read(trace, &n_insts, &sim_conf);
+    if (insts && use_deps && load_trace_deps(trace, trace_path) != 0) {
+        free(insts);
+        insts = NULL;
+    }
     fclose(trace);
     if (!insts) {
         return 1;
     }
+    if (trace_apply_branch_predictor(insts, n_insts, &sim_conf, &sim_stats) != 0) {
+        free(insts);
+        return 1;
+    }
+
+    if (pareto) {
+        int ret = pareto_search(&sim_conf, pareto_margin);
+        free(insts);
+        free(deps);
+        return ret ? 1 : 0;
+    }
 
     print_sim_config(&sim_conf);
-    // Initialize the processor
-    procsim_init(&sim_conf, &sim_stats);
-    printf("SETUP COMPLETE - STARTING SIMULATION\n");
 
-    // We made this number up, but it should never take this many cycles to
-    // retire something
-    static const uint64_t max_cycles_since_last_retire = 128;
-    uint64_t cycles_since_last_retire = 0;
-
-    uint64_t retired_inst_idx = 0;
-    fetch_inst_idx = 0;
-    while (retired_inst_idx < n_insts) {
-        bool retired_mispredict = false;
-        uint64_t retired_this_cycle = procsim_do_cycle(&sim_stats, &retired_mispredict);
-        retired_inst_idx += retired_this_cycle;
-        // Check for deadlocks (e.g., an empty submission)
-        if (retired_this_cycle) {
-            cycles_since_last_retire = 0;
-        } else {
-            cycles_since_last_retire++;
-        }
-        if (cycles_since_last_retire == max_cycles_since_last_retire) {
-            printf("\nIt has been %" PRIu64 " cycles since the last retirement."
-                   " Does the simulator have a deadlock?\n",
-                   max_cycles_since_last_retire);
+    estimate_t est;
+    if (estimate) {
+        if (estimate_ipc(insts, deps, n_insts, &sim_conf, &est) != 0) {
+            perror("estimate_ipc");
             return 1;
         }
-
-        if (retired_mispredict) {
-            // Start refilling the dispatch queue now that mispredict is handled
-            fetch_inst_idx = retired_inst_idx;
-            in_mispred = false;
+        if (!estimate_check) {
+            print_estimate(&est, NULL);
+            free(insts);
+            free(deps);
+            return 0;
         }
+    }
 
-        
-        if (icache_miss_ctr != 0) {
-            icache_miss_ctr--;
+    if (hotspot_n && (hotspots = hotspot_create()) == NULL) {
+        perror("hotspot_create");
+        return 1;
+    }
+    if (num_segments) {
+        printf("Segments: %zu, %zu instruction warm-up\n", num_segments, warmup);
+    }
+    if (early_term.precision) {
+        printf("Precision: +/- %.2f%% IPC, %" PRIu64 " cycle batches\n",
+               100 * early_term.precision, early_term.batch_cycles);
+    }
+    printf("SETUP COMPLETE - STARTING SIMULATION\n");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (num_segments) {
+        if (run_segmented(&sim_conf, &sim_stats, num_segments, warmup) != 0) {
+            return 1;
+        }
+    } else if (early_term.precision) {
+        if (run_early_terminated(&sim_conf, &sim_stats, &early_term, hotspots) != 0) {
+            return 1;
         }
-        if (icache_miss_ctr == 0 && in_icache_miss) {
-            in_icache_miss = false;
-            finished_miss = true;
+    } else if (memoize) {
+        if (memo_simulate(&sim_conf, insts, n_insts, &sim_stats, &memo_report) != 0) {
+            return 1;
         }
+    } else if (diff_ref) {
+        if (run_reference_diff(&sim_conf, &sim_stats) != 0) {
+            return 1;
+        }
+    } else if (run_simulation(&sim_conf, &sim_stats, 0, hotspots) != 0) {
+        return 1;
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-    sim_stats.instructions_in_trace = n_insts;
-
-    // Free memory and generate final statistics
-    procsim_finish(&sim_stats);
+    procsim_stats_t serial_stats;
+    if (segments_check) {
+        memset(&serial_stats, 0, sizeof serial_stats);
+        if (run_simulation(&sim_conf, &serial_stats, 0, NULL) != 0) {
+            return 1;
+        }
+    }
     free(insts);
+    free(deps);
+    if (cache_dir) {
+        result_cache_store(cache_dir, cache_key, &sim_stats);
+    }
 
-    print_sim_output(&sim_stats);
+    print_sim_output(&sim_conf, &sim_stats);
+    if (cpi_stack) {
+        print_cpi_stack(&sim_stats);
+    }
+    if (latency) {
+        print_latency_output(&sim_stats);
+    }
+    if (hotspots != NULL) {
+        print_hotspots(hotspots, hotspot_n);
+        hotspot_destroy(hotspots);
+    }
+    if (host_timing) {
+        double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        printf("\nHOST TIMING\n");
+        printf("Simulation time:      %.3f ms\n", ns / 1e6);
+        printf("Per simulated cycle:  %.1f ns\n", ns / sim_stats.cycles);
+        printf("Per instruction:      %.1f ns\n", ns / sim_stats.instructions_retired);
+    }
+    if (estimate_check) {
+        print_estimate(&est, &sim_stats);
+    }
+    if (segments_check) {
+        print_segment_check(&sim_stats, &serial_stats);
+    }
+    if (early_term.precision) {
+        print_early_termination(&early_term, &sim_stats);
+    }
+    if (memoize) {
+        print_memoization(&memo_report, &sim_stats);
+    }
+    if (diff_ref) {
+        printf("\nREFERENCE CHECK\n");
+        printf("Cycles compared:            %" PRIu64 "\n", sim_stats.cycles);
+        printf("State matched the reference model in every cycle\n");
+    }
 
     return 0;
 }
@@ -0,0 +1,20 @@
+#ifndef PROCSIM_REF_H
+#define PROCSIM_REF_H
+
+#include "procsim.hpp"
+
+// The original pipeline model in procsim_ref.cpp, which procsim.cpp can be
+// run against cycle by cycle to check that it is still cycle-exact
+// (--diff-ref). It models only configurations without a DispQ limit, ROB
+// size, MSHRs, L2, prefetcher or speculative disambiguation, and keeps its
+// state in globals, so only one reference core can exist at a time. It
+// fetches through the calling thread's current trace cursor, like procsim.cpp.
+
+/* procsim_init(), procsim_do_cycle() and procsim_finish() of the reference */
+void procsim_ref_init(const procsim_conf_t *sim_conf, procsim_stats_t *stats);
+uint64_t procsim_ref_do_cycle(procsim_stats_t *stats, bool *retired_mispredict_out);
+void procsim_ref_finish(procsim_stats_t *stats);
+/* procsim_snapshot() of the reference */
+void procsim_ref_snapshot(procsim_snapshot_t *snap);
+
+#endif
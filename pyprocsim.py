@@ -0,0 +1,262 @@
+"""ctypes bindings for libprocsim (build it with `make lib`).
+
+Runs the simulator in-process, so sweeps need neither a process per
+configuration nor parsing of the text output:
+
+    import pyprocsim
+    trace = pyprocsim.Trace("traces/tiledmm_25K.trace")
+    print(pyprocsim.run(trace, fetch_width=8, num_pregs=128)["ipc"])
+    results = pyprocsim.sweep(trace, fetch_width=[2, 4, 8], num_alu_fus=[1, 2, 3])
+
+sweep() returns a NumPy structured array when NumPy is installed and a list
+of dicts otherwise. The library releases the GIL while simulating and keeps
+every simulation's state per thread, so sweeps run on several threads.
+"""
+
+import ctypes
+import itertools
+import os
+from concurrent.futures import ThreadPoolExecutor
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
+API_VERSION = 9
+
+BRANCH_PREDICTORS = {"trace": 0, "bimodal": 1, "gshare": 2, "tage": 3}
+PREFETCHERS = {"none": 0, "next-line": 1, "stride": 2, "stream": 3}
+DISAMBIG_POLICIES = {"conservative": 0, "speculative": 1, "store-sets": 2}
+
+
+class Conf(ctypes.Structure):
+    """Mirror of procsim_conf_t"""
+    _fields_ = [
+        ("fetch_width", ctypes.c_size_t),
+        ("num_rob_entries", ctypes.c_size_t),
+        ("num_schedq_entries_per_fu", ctypes.c_size_t),
+        ("num_pregs", ctypes.c_size_t),
+        ("num_alu_fus", ctypes.c_size_t),
+        ("num_mul_fus", ctypes.c_size_t),
+        ("num_lsu_fus", ctypes.c_size_t),
+        ("num_dispq_entries", ctypes.c_size_t),
+        ("num_mshrs", ctypes.c_size_t),
+        ("l2_size_kib", ctypes.c_size_t),
+        ("l2_assoc", ctypes.c_size_t),
+        ("l2_latency", ctypes.c_size_t),
+        ("l2_banks", ctypes.c_size_t),
+        ("dram_latency", ctypes.c_size_t),
+        ("dram_banks", ctypes.c_size_t),
+        ("dram_bank_busy", ctypes.c_size_t),
+        ("prefetcher", ctypes.c_int),
+        ("prefetch_degree", ctypes.c_size_t),
+        ("disambig_policy", ctypes.c_int),
+        ("early_recovery", ctypes.c_bool),
+        ("redirect_penalty", ctypes.c_size_t),
+        ("misses_enabled", ctypes.c_bool),
+        ("branch_predictor", ctypes.c_int),
+        ("latency_histograms", ctypes.c_bool),
+    ]
+
+
+_U64 = ctypes.c_uint64
+_F64 = ctypes.c_double
+
+
+class Stats(ctypes.Structure):
+    """Mirror of procsim_stats_t"""
+    _fields_ = [
+        ("cycles", _U64),
+        ("instructions_fetched", _U64),
+        ("instructions_retired", _U64),
+        ("branch_mispredictions", _U64),
+        ("mispredict_recovery_cycles", _U64),
+        ("icache_misses", _U64),
+        ("reads", _U64),
+        ("store_buffer_read_hits", _U64),
+        ("dcache_reads", _U64),
+        ("dcache_read_misses", _U64),
+        ("dcache_read_hits", _U64),
+        ("l2_reads", _U64),
+        ("l2_read_misses", _U64),
+        ("l2_read_cycles", _U64),
+        ("l2_queue_cycles", _U64),
+        ("dram_read_cycles", _U64),
+        ("dram_queue_cycles", _U64),
+        ("store_buffer_hit_ratio", _F64),
+        ("dcache_read_miss_ratio", _F64),
+        ("dcache_ratio", _F64),
+        ("dcache_read_aat", _F64),
+        ("read_aat", _F64),
+        ("l2_read_aat", _F64),
+        ("dram_read_aat", _F64),
+        ("no_dispatch_pregs_cycles", _U64),
+        ("rob_stall_cycles", _U64),
+        ("dispq_full_cycles", _U64),
+        ("mshr_merged_reads", _U64),
+        ("mshr_full_cycles", _U64),
+        ("prefetches_issued", _U64),
+        ("prefetch_hits", _U64),
+        ("prefetch_late_hits", _U64),
+        ("speculative_loads", _U64),
+        ("memory_violations", _U64),
+        ("memory_squashes", _U64),
+        ("replayed_instructions", _U64),
+        ("no_fire_cycles", _U64),
+        # Retire slots per CPI stack category, see cpi_category_t
+        ("cpi_slots", _U64 * 10),
+        ("dispq_max_size", _U64),
+        ("schedq_max_size", _U64),
+        ("rob_max_size", _U64),
+        ("dispq_avg_size", _F64),
+        ("schedq_avg_size", _F64),
+        ("rob_avg_size", _F64),
+        ("ipc", _F64),
+        # [opcode][queue, exec, rob][log-scale bucket], see procsim.hpp
+        ("latency_hist", _U64 * (5 * 3 * 64)),
+        ("latency_max", _U64 * (5 * 3)),
+        ("instructions_in_trace", _U64),
+        ("branches_in_trace", _U64),
+        ("branches_mispredicted_in_trace", _U64),
+    ]
+
+
+CONF_FIELDS = [name for name, _ in Conf._fields_]
+STATS_FIELDS = [name for name, _ in Stats._fields_]
+
+_lib = None
+
+
+def load_library(path=None):
+    """Load libprocsim from path, $PROCSIM_LIB or next to this module"""
+    global _lib
+    if path is None:
+        path = os.environ.get("PROCSIM_LIB") or os.path.join(
+            os.path.dirname(os.path.abspath(__file__)), "libprocsim.so")
+    lib = ctypes.CDLL(path)
+    lib.procsim_api_version.restype = ctypes.c_int
+    lib.procsim_api_conf_size.restype = ctypes.c_size_t
+    lib.procsim_api_stats_size.restype = ctypes.c_size_t
+    if lib.procsim_api_version() != API_VERSION:
+        raise RuntimeError("libprocsim API version %d, expected %d"
+                           % (lib.procsim_api_version(), API_VERSION))
+    if (lib.procsim_api_conf_size() != ctypes.sizeof(Conf) or
+            lib.procsim_api_stats_size() != ctypes.sizeof(Stats)):
+        raise RuntimeError("libprocsim struct layouts do not match pyprocsim")
+
+    lib.procsim_conf_default.argtypes = [ctypes.POINTER(Conf)]
+    lib.procsim_conf_default.restype = None
+    lib.procsim_trace_load.argtypes = [ctypes.c_char_p]
+    lib.procsim_trace_load.restype = ctypes.c_void_p
+    lib.procsim_trace_length.argtypes = [ctypes.c_void_p]
+    lib.procsim_trace_length.restype = ctypes.c_size_t
+    lib.procsim_trace_free.argtypes = [ctypes.c_void_p]
+    lib.procsim_trace_free.restype = None
+    lib.procsim_context_create.argtypes = [ctypes.POINTER(Conf)]
+    lib.procsim_context_create.restype = ctypes.c_void_p
+    lib.procsim_context_run.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                        ctypes.c_uint64, ctypes.POINTER(Stats)]
+    lib.procsim_context_run.restype = ctypes.c_int
+    lib.procsim_context_destroy.argtypes = [ctypes.c_void_p]
+    lib.procsim_context_destroy.restype = None
+    _lib = lib
+    return lib
+
+
+def _get_lib():
+    return _lib if _lib is not None else load_library()
+
+
+class Trace:
+    """A trace loaded into memory once and shared by any number of runs"""
+
+    def __init__(self, path):
+        self._lib = _get_lib()
+        self.path = path
+        self._handle = self._lib.procsim_trace_load(os.fsencode(path))
+        if not self._handle:
+            raise OSError("could not load trace %s" % path)
+
+    def __len__(self):
+        return self._lib.procsim_trace_length(self._handle)
+
+    def close(self):
+        if self._handle:
+            self._lib.procsim_trace_free(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+
+def make_conf(**params):
+    """procsim's default configuration with params overridden. As with -P,
+    num_rob_entries follows num_pregs unless it is given too"""
+    conf = Conf()
+    _get_lib().procsim_conf_default(ctypes.byref(conf))
+    if "num_pregs" in params and "num_rob_entries" not in params:
+        params["num_rob_entries"] = params["num_pregs"] + 32
+    for name, value in params.items():
+        if name == "branch_predictor" and isinstance(value, str):
+            value = BRANCH_PREDICTORS[value]
+        if name == "prefetcher" and isinstance(value, str):
+            value = PREFETCHERS[value]
+        if name == "disambig_policy" and isinstance(value, str):
+            value = DISAMBIG_POLICIES[value]
+        if name not in CONF_FIELDS:
+            raise KeyError("unknown configuration parameter %s" % name)
+        setattr(conf, name, value)
+    return conf
+
+
+def run(trace, max_insts=0, **params):
+    """Simulate the trace (its first max_insts instructions, if not 0) on the
+    default configuration with params overridden, returning the stats as a
+    dict"""
+    lib = _get_lib()
+    conf = make_conf(**params)
+    ctx = lib.procsim_context_create(ctypes.byref(conf))
+    if not ctx:
+        raise ValueError("invalid configuration %r" % params)
+    try:
+        stats = Stats()
+        if lib.procsim_context_run(ctx, trace._handle, max_insts, ctypes.byref(stats)) != 0:
+            raise RuntimeError("simulation failed for %r" % params)
+    finally:
+        lib.procsim_context_destroy(ctx)
+    result = {}
+    for name, ctype in Stats._fields_:
+        value = getattr(stats, name)
+        result[name] = list(value) if issubclass(ctype, ctypes.Array) else value
+    return result
+
+
+def sweep(trace, max_insts=0, threads=None, **grid):
+    """Simulate every combination of the parameter lists in grid, e.g.
+    sweep(trace, fetch_width=[2, 4, 8], num_pregs=[64, 128]). Returns one
+    record per combination holding its parameters and stats"""
+    names = list(grid)
+    points = [dict(zip(names, values)) for values in itertools.product(*grid.values())]
+    with ThreadPoolExecutor(max_workers=threads or os.cpu_count()) as pool:
+        results = list(pool.map(lambda p: run(trace, max_insts, **p), points))
+    records = [dict(p, **r) for p, r in zip(points, results)]
+    if np is None:
+        return records
+
+    dtype = []
+    for name in names:
+        kind = "U16" if any(isinstance(p[name], str) for p in points) else "i8"
+        dtype.append((name, kind))
+    for name, ctype in Stats._fields_:
+        if issubclass(ctype, ctypes.Array):
+            dtype.append((name, "u8", (ctype._length_,)))
+        else:
+            dtype.append((name, "f8" if ctype is _F64 else "u8"))
+    return np.array([tuple(r[d[0]] for d in dtype) for r in records], dtype=dtype)
@@ -0,0 +1,100 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.hpp"
+#include "result_cache.hpp"
+
+#define RESULT_CACHE_MAGIC "PSIMSTAT"
+
+typedef struct {
+    char magic[8];
+    uint32_t model_version;
+    uint32_t stats_size;
+    uint64_t key;
+} result_header_t;
+
+uint64_t result_cache_key(uint64_t trace_hash, const procsim_conf_t *conf) {
+    uint32_t model_version = PROCSIM_MODEL_VERSION;
+    uint32_t stats_size = sizeof(procsim_stats_t);
+    uint64_t hash = FNV1A64_INIT;
+    hash = fnv1a64(&trace_hash, sizeof trace_hash, hash);
+    hash = fnv1a64(conf, sizeof *conf, hash);
+    hash = fnv1a64(&model_version, sizeof model_version, hash);
+    hash = fnv1a64(&stats_size, sizeof stats_size, hash);
+    return hash;
+}
+
+/* path of the entry for key, to be freed by the caller */
+static char *entry_path(const char *dir, uint64_t key, const char *suffix) {
+    size_t len = strlen(dir) + 32 + strlen(suffix);
+    char *path = (char *)malloc(len);
+    if (path != NULL) {
+        snprintf(path, len, "%s/%016" PRIx64 "%s", dir, key, suffix);
+    }
+    return path;
+}
+
+int result_cache_load(const char *dir, uint64_t key, procsim_stats_t *stats_out) {
+    char *path = entry_path(dir, key, ".stats");
+    if (path == NULL) return -1;
+    FILE *f = fopen(path, "rb");
+    free(path);
+    if (f == NULL) return -1;
+
+    result_header_t header;
+    int ret = -1;
+    if (fread(&header, sizeof header, 1, f) == 1 &&
+            memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof header.magic) == 0 &&
+            header.model_version == PROCSIM_MODEL_VERSION &&
+            header.stats_size == sizeof(procsim_stats_t) &&
+            header.key == key &&
+            fread(stats_out, sizeof *stats_out, 1, f) == 1) {
+        ret = 0;
+    }
+    fclose(f);
+    return ret;
+}
+
+void result_cache_store(const char *dir, uint64_t key, const procsim_stats_t *stats) {
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        perror("mkdir");
+        return;
+    }
+    // Write under a unique name and rename into place, so that concurrent
+    // runs never see a partial entry
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, ".tmp%ld", (long)getpid());
+    char *tmp_path = entry_path(dir, key, suffix);
+    char *path = entry_path(dir, key, ".stats");
+    if (tmp_path == NULL || path == NULL) {
+        free(tmp_path);
+        free(path);
+        return;
+    }
+
+    result_header_t header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof header.magic);
+    header.model_version = PROCSIM_MODEL_VERSION;
+    header.stats_size = sizeof(procsim_stats_t);
+    header.key = key;
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        perror("fopen");
+    } else if (fwrite(&header, sizeof header, 1, f) != 1 ||
+               fwrite(stats, sizeof *stats, 1, f) != 1) {
+        perror("fwrite");
+        fclose(f);
+        remove(tmp_path);
+    } else if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        perror("result cache");
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    free(path);
+}
@@ -0,0 +1,22 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "procsim.hpp"
+
+// On-disk cache of simulation results, one file per (trace, configuration)
+// pair named after a hash of the trace contents, every procsim_conf_t byte,
+// PROCSIM_MODEL_VERSION and the procsim_stats_t layout. Changing any of them
+// changes the key, so stale results are never returned.
+
+#define RESULT_CACHE_DEFAULT_DIR ".procsim_cache"
+
+/* key of the results of simulating the trace with hash trace_hash on conf,
+ * which must have been zeroed before its fields were set */
+uint64_t result_cache_key(uint64_t trace_hash, const procsim_conf_t *conf);
+/* Returns 0 and fills in *stats_out on a hit, -1 on a miss */
+int result_cache_load(const char *dir, uint64_t key, procsim_stats_t *stats_out);
+/* Store the results under key, creating dir if needed. Failures only cost a
+ * later rerun, so they are reported and otherwise ignored */
+void result_cache_store(const char *dir, uint64_t key, const procsim_stats_t *stats);
+
+#endif
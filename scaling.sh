@@ -0,0 +1,56 @@
+#!/bin/bash
+set -e
+
+# Host-time scaling benchmark: simulates one long trace while the ROB, SchedQ
+# and preg counts grow 8x, and prints the host time per simulated cycle.
+# Usage: bash scaling.sh [trace] [repeats]
+
+trace=${1:-traces/tiledmm_25K.trace}
+repeats=${2:-40}
+
+# window scale: P, ROB entries, SchedQ entries per FU
+scales=( 1x 2x 4x 8x 8x_wide )
+flags_1x='-F 4 -P 64 -R 96 -S 2 -A 2 -M 1 -L 2'
+flags_2x='-F 4 -P 128 -R 192 -S 4 -A 2 -M 1 -L 2'
+flags_4x='-F 4 -P 256 -R 384 -S 8 -A 2 -M 1 -L 2'
+flags_8x='-F 4 -P 512 -R 768 -S 16 -A 2 -M 1 -L 2'
+flags_8x_wide='-F 16 -P 512 -R 1024 -S 16 -A 8 -M 4 -L 8'
+
+# Concatenates the trace with itself, renumbering the dynamic instruction
+# counts, so that start-up costs don't dominate the measurement
+make_long_trace() {
+    local out=$1
+    awk -v repeats="$repeats" '
+        { line[NR] = $0 }
+        END {
+            n = 0
+            for (r = 0; r < repeats; r++) {
+                for (i = 1; i <= NR; i++) {
+                    split(line[i], f, " ")
+                    f[7] = n++
+                    print f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8], f[9], f[10]
+                }
+            }
+        }' "$trace" > "$out"
+}
+
+main() {
+    local long_trace
+    long_trace=$(mktemp)
+    trap 'rm -f "$long_trace"' EXIT
+    make_long_trace "$long_trace"
+
+    printf 'Trace: %s repeated %s times\n\n' "$trace" "$repeats"
+    printf '%-8s %-40s %8s %12s\n' scale flags IPC ns/cycle
+    for scale in "${scales[@]}"; do
+        local flags_var=flags_$scale
+        local out
+        out=$(bash run.sh ${!flags_var} --experimental --host-timing -I "$long_trace")
+        local ipc ns
+        ipc=$(awk '/^IPC:/ { print $2 }' <<< "$out")
+        ns=$(awk '/^Per simulated cycle:/ { print $4 }' <<< "$out")
+        printf '%-8s %-40s %8s %12s\n' "$scale" "${!flags_var}" "$ipc" "$ns"
+    done
+}
+
+main "$@"
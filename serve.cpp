@@ -0,0 +1,315 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "procsim_capi.h"
+#include "serve.hpp"
+
+#define SERVE_MAX_LINE 1024
+
+// size_t fields of procsim_conf_t that jobs can set by name
+typedef struct {
+    const char *name;
+    size_t offset;
+} serve_field_t;
+
+#define SERVE_FIELD(field) {#field, offsetof(procsim_conf_t, field)}
+static const serve_field_t serve_fields[] = {
+    SERVE_FIELD(fetch_width),
+    SERVE_FIELD(num_rob_entries),
+    SERVE_FIELD(num_schedq_entries_per_fu),
+    SERVE_FIELD(num_pregs),
+    SERVE_FIELD(num_alu_fus),
+    SERVE_FIELD(num_mul_fus),
+    SERVE_FIELD(num_lsu_fus),
+    SERVE_FIELD(num_dispq_entries),
+    SERVE_FIELD(num_mshrs),
+    SERVE_FIELD(l2_size_kib),
+    SERVE_FIELD(l2_assoc),
+    SERVE_FIELD(l2_latency),
+    SERVE_FIELD(l2_banks),
+    SERVE_FIELD(dram_latency),
+    SERVE_FIELD(dram_banks),
+    SERVE_FIELD(dram_bank_busy),
+    SERVE_FIELD(prefetch_degree),
+    SERVE_FIELD(redirect_penalty),
+};
+#undef SERVE_FIELD
+
+// A client, whose jobs' results go to out in the order they finish
+typedef struct {
+    FILE *out;
+    std::mutex out_lock;
+    bool gone;       // A reply failed, under out_lock
+    size_t pending;  // Jobs queued or running, under the server's lock
+} serve_client_t;
+
+typedef struct {
+    char id[64];
+    size_t trace;
+    uint64_t max_insts;
+    procsim_conf_t conf;
+    serve_client_t *client;
+} serve_job_t;
+
+// Jobs of every client, in the order they arrived
+typedef struct {
+    procsim_trace_t **traces;
+    size_t num_traces;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<serve_job_t> jobs;
+    bool closing;
+    // Signaled when a job finishes or a socket client leaves
+    std::condition_variable done_cv;
+    size_t num_clients;
+} server_t;
+
+static void serve_reply(serve_client_t *client, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void serve_reply(serve_client_t *client, const char *fmt, ...) {
+    std::lock_guard<std::mutex> guard(client->out_lock);
+    if (client->gone) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int written = vfprintf(client->out, fmt, ap);
+    va_end(ap);
+    // A client that hung up gets no more replies, and its jobs are dropped
+    if (written < 0 || fflush(client->out) != 0) {
+        client->gone = true;
+    }
+}
+
+static bool serve_client_gone(serve_client_t *client) {
+    std::lock_guard<std::mutex> guard(client->out_lock);
+    return client->gone;
+}
+
+/* Parse a job line into *job, starting from base. Returns NULL on success
+ * or the reason the line is not a job */
+static const char *parse_job(char *line, const procsim_conf_t *base, size_t num_traces,
+                             serve_job_t *job) {
+    char *save;
+    char *id = strtok_r(line, " \t\r\n", &save);
+    char *trace = strtok_r(NULL, " \t\r\n", &save);
+    if (id == NULL) return "empty line";
+    snprintf(job->id, sizeof job->id, "%s", id);
+    if (trace == NULL) return "no trace index";
+    char *end;
+    job->trace = strtoul(trace, &end, 10);
+    if (*end != '\0' || job->trace >= num_traces) return "bad trace index";
+    job->max_insts = 0;
+    job->conf = *base;
+    bool rob_given = false;
+    for (char *tok; (tok = strtok_r(NULL, " \t\r\n", &save)) != NULL; ) {
+        char *value = strchr(tok, '=');
+        if (value == NULL) return "expected <field>=<value>";
+        *value++ = '\0';
+        if (strcmp(tok, "max_insts") == 0) {
+            job->max_insts = strtoull(value, &end, 10);
+        } else if (strcmp(tok, "branch_predictor") == 0) {
+            if (bpred_parse_kind(value, &job->conf.branch_predictor) != 0) return "unknown branch predictor";
+            continue;
+        } else if (strcmp(tok, "prefetcher") == 0) {
+            if (prefetch_parse_kind(value, &job->conf.prefetcher) != 0) return "unknown prefetcher";
+            continue;
+        } else if (strcmp(tok, "disambig_policy") == 0) {
+            if (disambig_parse_policy(value, &job->conf.disambig_policy) != 0) return "unknown disambiguation policy";
+            continue;
+        } else if (strcmp(tok, "misses_enabled") == 0) {
+            job->conf.misses_enabled = strtoul(value, &end, 10) != 0;
+        } else if (strcmp(tok, "early_recovery") == 0) {
+            job->conf.early_recovery = strtoul(value, &end, 10) != 0;
+        } else {
+            size_t i = 0;
+            while (i < sizeof serve_fields / sizeof serve_fields[0] && strcmp(tok, serve_fields[i].name) != 0) i++;
+            if (i == sizeof serve_fields / sizeof serve_fields[0]) return "unknown field";
+            *(size_t *)((char *)&job->conf + serve_fields[i].offset) = strtoull(value, &end, 10);
+            rob_given |= strcmp(tok, "num_rob_entries") == 0;
+            if (strcmp(tok, "num_pregs") == 0 && !rob_given) {
+                job->conf.num_rob_entries = job->conf.num_pregs + 32;
+            }
+        }
+        if (*value == '\0' || *end != '\0') return "bad number";
+    }
+    return NULL;
+}
+
+/* simulate one job and reply to its client */
+static void serve_run_job(server_t *srv, const serve_job_t *job) {
+    procsim_stats_t *stats = (procsim_stats_t *)malloc(sizeof(procsim_stats_t));
+    procsim_context_t *ctx = procsim_context_create(&job->conf);
+    if (stats == NULL) {
+        serve_reply(job->client, "%s error out of memory\n", job->id);
+    } else if (ctx == NULL) {
+        serve_reply(job->client, "%s error unusable configuration\n", job->id);
+    } else if (procsim_context_run(ctx, srv->traces[job->trace], job->max_insts, stats) != 0) {
+        serve_reply(job->client, "%s error simulation failed\n", job->id);
+    } else {
+        serve_reply(job->client, "%s ok %" PRIu64 " %" PRIu64 " %.6f %" PRIu64 " %" PRIu64 " %" PRIu64
+                    " %" PRIu64 " %.4f\n", job->id, stats->cycles, stats->instructions_retired,
+                    stats->ipc, stats->branch_mispredictions, stats->icache_misses,
+                    stats->dcache_read_misses, stats->store_buffer_read_hits, stats->read_aat);
+    }
+    procsim_context_destroy(ctx);
+    free(stats);
+}
+
+static void serve_worker(server_t *srv) {
+    while (1) {
+        serve_job_t job;
+        {
+            std::unique_lock<std::mutex> guard(srv->lock);
+            srv->cv.wait(guard, [&] { return !srv->jobs.empty() || srv->closing; });
+            if (srv->jobs.empty()) return;
+            job = srv->jobs.front();
+            srv->jobs.pop_front();
+        }
+        if (!serve_client_gone(job.client)) {
+            serve_run_job(srv, &job);
+        }
+        std::lock_guard<std::mutex> guard(srv->lock);
+        job.client->pending--;
+        srv->done_cv.notify_all();
+    }
+}
+
+/* queue every job read from in, answering on out, and wait for them all */
+static void serve_client(server_t *srv, const procsim_conf_t *base_conf, FILE *in, FILE *out) {
+    serve_client_t client;
+    client.out = out;
+    client.gone = false;
+    client.pending = 0;
+    char line[SERVE_MAX_LINE];
+    while (fgets(line, sizeof line, in) != NULL) {
+        serve_job_t job;
+        const char *err = parse_job(line, base_conf, srv->num_traces, &job);
+        if (err != NULL) {
+            if (strcmp(err, "empty line") != 0) serve_reply(&client, "%s error %s\n", job.id, err);
+            continue;
+        }
+        job.client = &client;
+        std::lock_guard<std::mutex> guard(srv->lock);
+        srv->jobs.push_back(job);
+        client.pending++;
+        srv->cv.notify_one();
+    }
+    std::unique_lock<std::mutex> guard(srv->lock);
+    srv->done_cv.wait(guard, [&] { return client.pending == 0; });
+}
+
+/* serve one socket client on its own thread, then close its connection */
+static void serve_connection(server_t *srv, const procsim_conf_t *base_conf, int fd) {
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    if (in != NULL && out != NULL) {
+        serve_client(srv, base_conf, in, out);
+    }
+    if (in != NULL) fclose(in); else close(fd);
+    if (out != NULL) fclose(out);
+    std::lock_guard<std::mutex> guard(srv->lock);
+    srv->num_clients--;
+    srv->done_cv.notify_all();
+}
+
+/* listening Unix-domain socket at path, or -1 */
+static int serve_listen(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) != 0 || listen(fd, 8) != 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve_main(const char *const *trace_paths, size_t num_traces,
+               const procsim_conf_t *base_conf, const char *socket_path,
+               size_t num_workers) {
+    // Replies to a client that hung up fail with EPIPE instead of killing
+    // the server
+    signal(SIGPIPE, SIG_IGN);
+    server_t *srv = new server_t();
+    srv->num_traces = num_traces;
+    srv->traces = (procsim_trace_t **)calloc(num_traces, sizeof(procsim_trace_t *));
+    int ret = -1;
+    int listen_fd = -1;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_traces; i++) {
+        if ((srv->traces[i] = procsim_trace_load(trace_paths[i])) == NULL) {
+            goto out;
+        }
+        fprintf(stderr, "Trace %zu: %s, %zu instructions\n", i, trace_paths[i],
+                procsim_trace_length(srv->traces[i]));
+    }
+    if (socket_path != NULL && (listen_fd = serve_listen(socket_path)) < 0) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < num_workers; i++) {
+        workers.emplace_back(serve_worker, srv);
+    }
+    if (socket_path == NULL) {
+        serve_client(srv, base_conf, stdin, stdout);
+        ret = 0;
+    } else {
+        fprintf(stderr, "Serving on %s with %zu workers\n", socket_path, num_workers);
+        while (1) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                perror("accept");
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> guard(srv->lock);
+                srv->num_clients++;
+            }
+            std::thread(serve_connection, srv, base_conf, fd).detach();
+        }
+        std::unique_lock<std::mutex> guard(srv->lock);
+        srv->done_cv.wait(guard, [&] { return srv->num_clients == 0; });
+    }
+    {
+        std::lock_guard<std::mutex> guard(srv->lock);
+        srv->closing = true;
+        srv->cv.notify_all();
+    }
+    for (std::thread &t : workers) t.join();
+
+out:
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    for (size_t i = 0; i < num_traces; i++) procsim_trace_free(srv->traces[i]);
+    free(srv->traces);
+    delete srv;
+    return ret;
+}
@@ -0,0 +1,35 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "procsim.hpp"
+
+// Simulation server. The traces are loaded once, and then every job line
+// read from stdin, or from the clients of a Unix-domain socket, each read on
+// its own thread, is simulated on a shared pool of worker threads. A job
+// line is
+//
+//     <job id> <trace index> [max_insts=<N>] [<conf field>=<value> ...]
+//
+// where the conf fields are those of procsim_conf_t (fetch_width,
+// num_pregs, l2_size_kib, ...), prefetcher, disambig_policy and
+// branch_predictor take their names, and the rest of the configuration
+// comes from the server's command line. As with -P, num_rob_entries follows
+// num_pregs unless it is given too. Each job is answered, in the order the
+// jobs finish, by one line
+//
+//     <job id> ok <cycles> <retired> <IPC> <branch mispredictions>
+//         <I-cache misses> <D-cache read misses> <store buffer read hits>
+//         <average read access time>
+//
+// or "<job id> error <reason>".
+
+// Most worker threads simulating jobs at once
+#define MAX_SERVE_THREADS 256
+
+/* Serve jobs on the traces until stdin, or the socket when socket_path is
+ * not NULL, is closed. Returns 0 on success, -1 on error */
+int serve_main(const char *const *trace_paths, size_t num_traces,
+               const procsim_conf_t *base_conf, const char *socket_path,
+               size_t num_workers);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "storeset.hpp"
+
+static const char *const disambig_names[] = {"conservative", "speculative", "store-sets"};
+
+struct store_sets {
+    // Store set + 1 of each PC slot, 0 for none
+    uint32_t ssit[STORE_SETS_SSIT_ENTRIES];
+    uint64_t lfst[STORE_SETS_MAX];
+    uint32_t next_set;  // Sets are handed out round robin
+    uint64_t lookups;
+};
+
+static inline size_t ssit_index(uint64_t pc) {
+    return (pc >> 2) % STORE_SETS_SSIT_ENTRIES;
+}
+
+store_sets_t *store_sets_create(void) {
+    return (store_sets_t *)calloc(1, sizeof(store_sets_t));
+}
+
+uint32_t store_sets_lookup(store_sets_t *ss, uint64_t pc) {
+    if (++ss->lookups == STORE_SETS_CLEAR_INTERVAL) {
+        memset(ss->ssit, 0, sizeof ss->ssit);
+        memset(ss->lfst, 0, sizeof ss->lfst);
+        ss->lookups = 0;
+    }
+    uint32_t set = ss->ssit[ssit_index(pc)];
+    return set ? set - 1 : STORE_SET_NONE;
+}
+
+uint64_t store_sets_last_store(const store_sets_t *ss, uint32_t set) {
+    return ss->lfst[set];
+}
+
+void store_sets_set_last_store(store_sets_t *ss, uint32_t set, uint64_t dyn_instruction_count) {
+    ss->lfst[set] = dyn_instruction_count + 1;
+}
+
+void store_sets_violation(store_sets_t *ss, uint64_t load_pc, uint64_t store_pc) {
+    uint32_t *load_set = &ss->ssit[ssit_index(load_pc)];
+    uint32_t *store_set = &ss->ssit[ssit_index(store_pc)];
+    if (*load_set == 0 && *store_set == 0) {
+        *load_set = *store_set = ss->next_set + 1;
+        ss->next_set = (ss->next_set + 1) % STORE_SETS_MAX;
+    } else if (*load_set == 0) {
+        *load_set = *store_set;
+    } else if (*store_set == 0) {
+        *store_set = *load_set;
+    } else {
+        // Both already have a set: the smaller one wins, so two sets that
+        // keep violating settle on one
+        uint32_t set = *load_set < *store_set ? *load_set : *store_set;
+        *load_set = *store_set = set;
+    }
+}
+
+void store_sets_destroy(store_sets_t *ss) {
+    free(ss);
+}
+
+int disambig_parse_policy(const char *name, disambig_policy_t *policy_out) {
+    for (size_t i = 0; i < sizeof disambig_names / sizeof disambig_names[0]; i++) {
+        if (strcmp(name, disambig_names[i]) == 0) {
+            *policy_out = (disambig_policy_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *disambig_policy_name(disambig_policy_t policy) {
+    return disambig_names[policy];
+}
@@ -0,0 +1,47 @@
+#ifndef STORESET_H
+#define STORESET_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// How loads are ordered against older stores that have not executed yet
+typedef enum {
+    DISAMBIG_CONSERVATIVE = 0,  // Loads wait for every older store
+    DISAMBIG_SPECULATIVE,       // Loads never wait, and are replayed on a violation
+    DISAMBIG_STORE_SETS,        // Loads wait only for the stores a store-set predictor names
+} disambig_policy_t;
+
+// Store-set memory dependence predictor (Chrysos and Emer). The store set ID
+// table (SSIT) maps load and store PCs to store sets, and the last fetched
+// store table (LFST) remembers the youngest dispatched store of each set,
+// which later loads of the set wait for. A load and a store whose order was
+// violated are put in the same set. Both tables are cleared every
+// STORE_SETS_CLEAR_INTERVAL lookups so stale sets do not hold loads back for
+// good.
+
+#define STORE_SETS_SSIT_ENTRIES 4096
+#define STORE_SETS_MAX 256
+#define STORE_SETS_CLEAR_INTERVAL 1000000
+#define STORE_SET_NONE UINT32_MAX
+
+typedef struct store_sets store_sets_t;
+
+/* Returns NULL on allocation failure */
+store_sets_t *store_sets_create(void);
+/* store set of the load or store at pc, or STORE_SET_NONE */
+uint32_t store_sets_lookup(store_sets_t *ss, uint64_t pc);
+/* last store dispatched in the set, as its dyn_instruction_count + 1, or 0 */
+uint64_t store_sets_last_store(const store_sets_t *ss, uint32_t set);
+void store_sets_set_last_store(store_sets_t *ss, uint32_t set, uint64_t dyn_instruction_count);
+/* The load at load_pc read before an older store at store_pc wrote its
+ * address: put them in the same store set */
+void store_sets_violation(store_sets_t *ss, uint64_t load_pc, uint64_t store_pc);
+void store_sets_destroy(store_sets_t *ss);
+
+/* Parse a policy name (conservative, speculative, store-sets).
+ * Returns 0 on success, -1 on unknown name */
+int disambig_parse_policy(const char *name, disambig_policy_t *policy_out);
+const char *disambig_policy_name(disambig_policy_t policy);
+
+#endif
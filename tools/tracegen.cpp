@@ -0,0 +1,317 @@
+// Synthetic trace generator for stress and scaling benchmarks. Writes traces
+// in the driver's text format, or with -b in its binary format, with a
+// controllable length, opcode mix, dependence distances, address locality and
+// miss rates. The same options and seed always produce the same trace.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.hpp"
+
+// Instructions whose destinations are remembered for picking producers
+#define DEP_HISTORY 1024
+// Recently touched addresses that local accesses stay near
+#define ADDR_HISTORY 16
+#define CODE_BASE 0x10000
+#define DATA_BASE 0x40000000ULL
+
+enum {
+    OPT_SEED = 256,
+    OPT_MIX,
+    OPT_DEP_MEAN,
+    OPT_LOCALITY,
+    OPT_FOOTPRINT,
+    OPT_MISPREDICT,
+    OPT_ICACHE_MISS,
+    OPT_DCACHE_MISS,
+};
+
+typedef struct {
+    uint64_t length;
+    uint64_t seed;
+    // Relative weights of ADD, MUL, LOAD, STORE and BRANCH
+    double mix[5];
+    // Mean distance in instructions from a source's producer
+    double dep_mean;
+    // Probability that a memory access stays near a recently used address
+    double locality;
+    uint64_t footprint;
+    double mispredict_rate;
+    double icache_miss_rate;
+    double dcache_miss_rate;
+    bool binary;
+} gen_conf_t;
+
+static uint64_t rng_state;
+
+/* splitmix64, so traces do not depend on the C library's rand() */
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static double rng_uniform(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool rng_chance(double p) {
+    return rng_uniform() < p;
+}
+
+/* geometric distance >= 1 with the given mean */
+static uint64_t rng_geometric(double mean) {
+    if (mean <= 1) return 1;
+    double u = rng_uniform();
+    return 1 + (uint64_t)(log(1 - u) / log(1 - 1 / mean));
+}
+
+static void print_usage(const char *err) {
+    fprintf(stderr, "%s\n", err);
+    fprintf(stderr, "tracegen -n <instructions> [Options]\n");
+    fprintf(stderr, "-o <file> output file (default stdout)\n");
+    fprintf(stderr, "-b writes the binary trace format\n");
+    fprintf(stderr, "--seed <n> (default 1)\n");
+    fprintf(stderr, "--mix <add,mul,load,store,branch> opcode weights (default 40,10,25,10,15)\n");
+    fprintf(stderr, "--dep-mean <n> mean distance to a source's producer (default 4)\n");
+    fprintf(stderr, "--locality <p> probability an access stays near a recent one (default 0.8)\n");
+    fprintf(stderr, "--footprint <bytes> data footprint of the other accesses (default 16M)\n");
+    fprintf(stderr, "--mispredict <rate> per branch (default 0.05)\n");
+    fprintf(stderr, "--icache-miss <rate> per instruction (default 0.01)\n");
+    fprintf(stderr, "--dcache-miss <rate> per load or store (default 0.05)\n");
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t v = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': return v << 10;
+        case 'm': case 'M': return v << 20;
+        case 'g': case 'G': return v << 30;
+        default: return v;
+    }
+}
+
+/* pick a source register: usually the destination of an instruction
+ * dep_mean instructions back, otherwise any register */
+static int8_t pick_source(const int8_t *dest_history, uint64_t i, double dep_mean) {
+    uint64_t dist = rng_geometric(dep_mean);
+    if (dist <= i && dist < DEP_HISTORY) {
+        int8_t reg = dest_history[(i - dist) % DEP_HISTORY];
+        if (reg > 0) return reg;
+    }
+    return 1 + rng_next() % (NUM_REGS - 1);
+}
+
+static int generate(const gen_conf_t *gc, FILE *out) {
+    static const opcode_t opcodes[5] = {OPCODE_ADD, OPCODE_MUL, OPCODE_LOAD, OPCODE_STORE, OPCODE_BRANCH};
+    double mix_total = 0;
+    for (int k = 0; k < 5; k++) mix_total += gc->mix[k];
+
+    if (gc->binary) {
+        trace_binary_header_t header;
+        memset(&header, 0, sizeof header);
+        memcpy(header.magic, TRACE_BINARY_MAGIC, sizeof header.magic);
+        header.version = TRACE_BINARY_VERSION;
+        header.record_size = sizeof(trace_record_t);
+        header.n_insts = gc->length;
+        if (fwrite(&header, sizeof header, 1, out) != 1) {
+            perror("fwrite");
+            return -1;
+        }
+    }
+
+    int8_t dest_history[DEP_HISTORY];
+    memset(dest_history, 0, sizeof dest_history);
+    uint64_t addr_history[ADDR_HISTORY];
+    for (int k = 0; k < ADDR_HISTORY; k++) {
+        addr_history[k] = DATA_BASE + (rng_next() % gc->footprint & ~7ULL);
+    }
+    uint64_t pc = CODE_BASE;
+
+    for (uint64_t i = 0; i < gc->length; i++) {
+        double pick = rng_uniform() * mix_total;
+        int k = 0;
+        while (k < 4 && pick >= gc->mix[k]) pick -= gc->mix[k++];
+        trace_record_t rec;
+        memset(&rec, 0, sizeof rec);
+        rec.pc = pc;
+        rec.opcode = opcodes[k];
+        rec.dyn_instruction_count = i;
+        rec.dest = -1;
+        rec.src1 = -1;
+        rec.src2 = -1;
+
+        switch (rec.opcode) {
+            case OPCODE_ADD:
+            case OPCODE_MUL:
+                rec.dest = 1 + rng_next() % (NUM_REGS - 1);
+                rec.src1 = pick_source(dest_history, i, gc->dep_mean);
+                rec.src2 = pick_source(dest_history, i, gc->dep_mean);
+                break;
+            case OPCODE_LOAD:
+            case OPCODE_STORE: {
+                if (rec.opcode == OPCODE_LOAD) {
+                    rec.dest = 1 + rng_next() % (NUM_REGS - 1);
+                } else {
+                    rec.src2 = pick_source(dest_history, i, gc->dep_mean);
+                }
+                rec.src1 = pick_source(dest_history, i, gc->dep_mean);
+                size_t slot = rng_next() % ADDR_HISTORY;
+                if (rng_chance(gc->locality)) {
+                    // Step a few words from a recent address
+                    addr_history[slot] += 8 * (rng_next() % 8);
+                } else {
+                    addr_history[slot] = DATA_BASE + (rng_next() % gc->footprint & ~7ULL);
+                }
+                rec.load_store_addr = addr_history[slot];
+                if (rng_chance(gc->dcache_miss_rate)) rec.flags |= TRACE_RECORD_DCACHE_MISS;
+                break;
+            }
+            case OPCODE_BRANCH:
+                rec.src1 = pick_source(dest_history, i, gc->dep_mean);
+                if (rng_chance(gc->mispredict_rate)) rec.flags |= TRACE_RECORD_MISPREDICT;
+                break;
+            default:
+                break;
+        }
+        if (rng_chance(gc->icache_miss_rate)) rec.flags |= TRACE_RECORD_ICACHE_MISS;
+        dest_history[i % DEP_HISTORY] = rec.dest;
+
+        // Taken branches jump back up to 64 instructions, like loops
+        if (rec.opcode == OPCODE_BRANCH && rng_chance(0.5)) {
+            uint64_t back = 4 * (1 + rng_next() % 64);
+            pc = pc - CODE_BASE >= back ? pc - back : CODE_BASE;
+        } else {
+            pc += 4;
+        }
+
+        if (gc->binary) {
+            if (fwrite(&rec, sizeof rec, 1, out) != 1) {
+                perror("fwrite");
+                return -1;
+            }
+        } else if (fprintf(out, "0x%" PRIx64 " %d %d %d %d 0x%" PRIx64 " %" PRIu64 " %d %d %d\n",
+                           rec.pc, rec.opcode, rec.dest, rec.src1, rec.src2, rec.load_store_addr,
+                           rec.dyn_instruction_count, !!(rec.flags & TRACE_RECORD_MISPREDICT),
+                           !!(rec.flags & TRACE_RECORD_ICACHE_MISS),
+                           !!(rec.flags & TRACE_RECORD_DCACHE_MISS)) < 0) {
+            perror("fprintf");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *const argv[]) {
+    gen_conf_t gc;
+    memset(&gc, 0, sizeof gc);
+    gc.seed = 1;
+    gc.mix[0] = 40;
+    gc.mix[1] = 10;
+    gc.mix[2] = 25;
+    gc.mix[3] = 10;
+    gc.mix[4] = 15;
+    gc.dep_mean = 4;
+    gc.locality = 0.8;
+    gc.footprint = 16 << 20;
+    gc.mispredict_rate = 0.05;
+    gc.icache_miss_rate = 0.01;
+    gc.dcache_miss_rate = 0.05;
+    const char *out_path = NULL;
+
+    static const struct option long_opts[] = {
+        {"seed", required_argument, NULL, OPT_SEED},
+        {"mix", required_argument, NULL, OPT_MIX},
+        {"dep-mean", required_argument, NULL, OPT_DEP_MEAN},
+        {"locality", required_argument, NULL, OPT_LOCALITY},
+        {"footprint", required_argument, NULL, OPT_FOOTPRINT},
+        {"mispredict", required_argument, NULL, OPT_MISPREDICT},
+        {"icache-miss", required_argument, NULL, OPT_ICACHE_MISS},
+        {"dcache-miss", required_argument, NULL, OPT_DCACHE_MISS},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "n:o:bh", long_opts, NULL))) {
+        switch (opt) {
+            case 'n':
+                gc.length = parse_size(optarg);
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'b':
+                gc.binary = true;
+                break;
+            case OPT_SEED:
+                gc.seed = strtoull(optarg, NULL, 10);
+                break;
+            case OPT_MIX:
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf,%lf", &gc.mix[0], &gc.mix[1], &gc.mix[2],
+                           &gc.mix[3], &gc.mix[4]) != 5) {
+                    print_usage("--mix takes five comma-separated weights");
+                }
+                break;
+            case OPT_DEP_MEAN:
+                gc.dep_mean = atof(optarg);
+                break;
+            case OPT_LOCALITY:
+                gc.locality = atof(optarg);
+                break;
+            case OPT_FOOTPRINT:
+                gc.footprint = parse_size(optarg);
+                break;
+            case OPT_MISPREDICT:
+                gc.mispredict_rate = atof(optarg);
+                break;
+            case OPT_ICACHE_MISS:
+                gc.icache_miss_rate = atof(optarg);
+                break;
+            case OPT_DCACHE_MISS:
+                gc.dcache_miss_rate = atof(optarg);
+                break;
+            default:
+                print_usage("");
+                break;
+        }
+    }
+    if (gc.length == 0) {
+        print_usage("No length given");
+    }
+    if (gc.footprint < 8) {
+        print_usage("The footprint must be at least 8 bytes");
+    }
+    double mix_total = 0;
+    for (int k = 0; k < 5; k++) {
+        if (gc.mix[k] < 0) print_usage("Opcode weights cannot be negative");
+        mix_total += gc.mix[k];
+    }
+    if (mix_total <= 0) {
+        print_usage("At least one opcode weight must be positive");
+    }
+    rng_state = gc.seed;
+
+    FILE *out = stdout;
+    if (out_path != NULL) {
+        out = fopen(out_path, gc.binary ? "wb" : "w");
+        if (out == NULL) {
+            perror("fopen");
+            return 1;
+        }
+    }
+    static char buf[1 << 20];
+    setvbuf(out, buf, _IOFBF, sizeof buf);
+    int ret = generate(&gc, out);
+    if (fclose(out) != 0) {
+        perror("fclose");
+        ret = -1;
+    }
+    return ret ? 1 : 0;
+}
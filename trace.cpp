@@ -0,0 +1,292 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.hpp"
+
+void trace_index_fetch_events(inst_t *insts_arr, size_t size_insts) {
+    uint32_t run = 0;
+    for (size_t i = size_insts; i-- > 0; ) {
+        inst_t *inst = &insts_arr[i];
+        if (inst->icache_miss || inst->mispredict) {
+            run = 0;
+        } else if (run != UINT32_MAX) {
+            run++;
+        }
+        inst->fetch_run = run;
+    }
+}
+
+// Replaces the trace's mispredict bits with the verdicts of the configured
+// predictor. The trace does not record branch directions, so a branch is
+// taken when the next instruction in the trace is not at pc + 4. Targets are
+// assumed to be predicted perfectly (i.e., an ideal BTB).
+int trace_apply_branch_predictor(inst_t *insts_arr, size_t size_insts,
+                                 const procsim_conf_t *sim_conf,
+                                 procsim_stats_t *sim_stats) {
+    if (sim_conf->branch_predictor == BPRED_TRACE || !sim_conf->misses_enabled) {
+        return 0;
+    }
+    bpred_t *bp = bpred_create(sim_conf->branch_predictor);
+    if (bp == NULL) {
+        perror("bpred_create");
+        return -1;
+    }
+    for (size_t i = 0; i < size_insts; i++) {
+        inst_t *inst = &insts_arr[i];
+        if (inst->opcode != OPCODE_BRANCH) {
+            continue;
+        }
+        bool taken = i + 1 < size_insts && insts_arr[i + 1].pc != inst->pc + 4;
+        bool predicted = bpred_predict(bp, inst->pc);
+        bpred_update(bp, inst->pc, taken);
+        inst->mispredict = predicted != taken;
+        sim_stats->branches_in_trace++;
+        sim_stats->branches_mispredicted_in_trace += inst->mispredict;
+    }
+    bpred_destroy(bp);
+    trace_index_fetch_events(insts_arr, size_insts);
+    return 0;
+}
+
+/* read the records of a binary trace whose magic has already been read */
+static inst_t *trace_read_binary(FILE *trace, size_t *size_insts_out, const procsim_conf_t *sim_conf) {
+    trace_binary_header_t header;
+    if (fseek(trace, 0, SEEK_SET) != 0 || fread(&header, sizeof header, 1, trace) != 1) {
+        fprintf(stderr, "could not read the binary trace header\n");
+        return NULL;
+    }
+    if (header.version != TRACE_BINARY_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "unsupported binary trace version %u\n", header.version);
+        return NULL;
+    }
+    inst_t *insts_arr = (inst_t *)malloc(header.n_insts * sizeof(inst_t));
+    if (insts_arr == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    trace_record_t records[4096];
+    size_t size_insts = 0;
+    while (size_insts < header.n_insts) {
+        size_t want = header.n_insts - size_insts;
+        if (want > sizeof records / sizeof records[0]) want = sizeof records / sizeof records[0];
+        if (fread(records, sizeof records[0], want, trace) != want) {
+            fprintf(stderr, "binary trace ends after %zu of %" PRIu64 " instructions\n",
+                    size_insts, header.n_insts);
+            free(insts_arr);
+            return NULL;
+        }
+        for (size_t i = 0; i < want; i++) {
+            const trace_record_t *rec = &records[i];
+            inst_t *inst = &insts_arr[size_insts++];
+            inst->pc = rec->pc;
+            inst->opcode = (opcode_t)rec->opcode;
+            inst->dest = rec->dest == 0 ? -1 : rec->dest;
+            inst->src1 = rec->src1;
+            inst->src2 = rec->src2;
+            inst->load_store_addr = rec->load_store_addr;
+            inst->dyn_instruction_count = rec->dyn_instruction_count;
+            inst->mispredict = (rec->flags & TRACE_RECORD_MISPREDICT) && sim_conf->misses_enabled;
+            inst->icache_miss = (rec->flags & TRACE_RECORD_ICACHE_MISS) && sim_conf->misses_enabled;
+            inst->dcache_miss = (rec->flags & TRACE_RECORD_DCACHE_MISS) && sim_conf->misses_enabled;
+        }
+    }
+    trace_index_fetch_events(insts_arr, size_insts);
+    *size_insts_out = size_insts;
+    return insts_arr;
+}
+
+inst_t *trace_read(FILE *trace, size_t *size_insts_out, const procsim_conf_t *sim_conf) {
+    char magic[8];
+    if (fread(magic, 1, sizeof magic, trace) == sizeof magic &&
+            memcmp(magic, TRACE_BINARY_MAGIC, sizeof magic) == 0) {
+        return trace_read_binary(trace, size_insts_out, sim_conf);
+    }
+    if (fseek(trace, 0, SEEK_SET) != 0) {
+        perror("fseek");
+        return NULL;
+    }
+
+    size_t size_insts = 0;
+    size_t cap_insts = 0;
+    inst_t *insts_arr = NULL;
+
+    while (!feof(trace)) {
+        if (size_insts == cap_insts) {
+            size_t new_cap_insts = 2 * (cap_insts + 1);
+            // redundant c++ cast #1
+            inst_t *new_insts_arr = (inst_t *)realloc(insts_arr, new_cap_insts * sizeof *insts_arr);
+            if (!new_insts_arr) {
+                perror("realloc");
+                goto error;
+            }
+            cap_insts = new_cap_insts;
+            insts_arr = new_insts_arr;
+        }
+
+        inst_t *inst = insts_arr + size_insts;
+        // TODO: update traces to pc, opcode, dr, sr1, sr2, ldst, inst_num, mispred, icmiss, dcmiss
+        int mispred;
+        int ic_miss;
+        int dc_miss;
+        int ret = fscanf(trace, "%" SCNx64 " %d %" SCNd8 " %" SCNd8 " %" SCNd8 " %" SCNx64 " %" SCNu64 " %d %d %d\n", &inst->pc, (int *)&inst->opcode, &inst->dest, &inst->src1, &inst->src2, &inst->load_store_addr, &inst->dyn_instruction_count, &mispred, &ic_miss, &dc_miss);
+
+        if (ret == 10) {
+            inst->mispredict = mispred && sim_conf->misses_enabled;
+            inst->icache_miss = ic_miss && sim_conf->misses_enabled;
+            inst->dcache_miss = dc_miss && sim_conf->misses_enabled;
+            if (inst->dest == 0) inst->dest = -1;
+            size_insts++;
+        } else {
+            if (ferror(trace)) {
+                perror("fscanf");
+            } else {
+                fprintf(stderr, "could not parse line %d in trace (only %d input items matched). is it corrupt?\n", (int) size_insts, ret);
+            }
+            goto error;
+        }
+    }
+
+    trace_index_fetch_events(insts_arr, size_insts);
+    *size_insts_out = size_insts;
+    return insts_arr;
+
+    error:
+    free(insts_arr);
+    *size_insts_out = 0;
+    return NULL;
+}
+
+
+static thread_local trace_cursor_t *cursor;
+
+size_t procsim_driver_read_insts(size_t max_insts, const inst_t **insts_out) {
+    if (cursor->in_mispred || cursor->in_icache_miss ||
+            cursor->fetch_inst_idx >= cursor->n_sim_insts) {
+        return 0;
+    }
+    const inst_t *first = &cursor->insts[cursor->fetch_inst_idx];
+    size_t limit = cursor->n_sim_insts - cursor->fetch_inst_idx;
+    if (limit > max_insts) limit = max_insts;
+    size_t n = 0;
+    while (n < limit) {
+        const inst_t *inst = &first[n];
+        // Take everything before the next front-end event in one go
+        if (inst->fetch_run != 0) {
+            n += inst->fetch_run < limit - n ? inst->fetch_run : limit - n;
+            continue;
+        }
+        if (inst->icache_miss) {
+            if (!cursor->finished_miss) { // if didnt just finish a cache miss
+                cursor->in_icache_miss = true;
+                cursor->icache_miss_ctr = L1_MISS_PENALTY;
+                break; // can't give you an instruction that missed in cache
+            }
+            cursor->finished_miss = false; // reset state for icache misses
+        }
+        n++;
+        if (inst->mispredict) {
+            cursor->in_mispred = true;
+            break;
+        }
+    }
+    cursor->fetch_inst_idx += n;
+    *insts_out = first;
+    return n;
+}
+
+const inst_t *procsim_driver_read_inst(void) {
+    const inst_t *inst;
+    return procsim_driver_read_insts(1, &inst) ? inst : NULL;
+}
+
+void procsim_driver_refetch(const inst_t *inst) {
+    cursor->fetch_inst_idx = inst - cursor->insts;
+    // A squashed mispredicted branch no longer holds fetch up
+    cursor->in_mispred = false;
+}
+
+void trace_cursor_init(trace_cursor_t *c, const inst_t *trace_insts, size_t n_sim_insts) {
+    memset(c, 0, sizeof *c);
+    c->insts = trace_insts;
+    c->n_sim_insts = n_sim_insts;
+}
+
+void trace_cursor_select(trace_cursor_t *c) {
+    cursor = c;
+}
+
+bool trace_cursor_done(const trace_cursor_t *c) {
+    return c->retired_inst_idx >= c->n_sim_insts;
+}
+
+int trace_cursor_cycle_with(trace_cycle_fn_t do_cycle, procsim_stats_t *sim_stats) {
+    // We made this number up, but it should never take this many cycles to
+    // retire something
+    static const uint64_t max_cycles_since_last_retire = 128;
+
+    bool retired_mispredict = false;
+    uint64_t retired_this_cycle = do_cycle(sim_stats, &retired_mispredict);
+    cursor->retired_inst_idx += retired_this_cycle;
+    // Check for deadlocks (e.g., an empty submission)
+    if (retired_this_cycle) {
+        cursor->cycles_since_last_retire = 0;
+    } else {
+        cursor->cycles_since_last_retire++;
+    }
+    // Past the made-up limit, allow for the slowest D-cache miss too
+    if (cursor->cycles_since_last_retire ==
+            max_cycles_since_last_retire + procsim_watchdog_allowance()) {
+        printf("\nIt has been %" PRIu64 " cycles since the last retirement."
+               " Does the simulator have a deadlock?\n",
+               cursor->cycles_since_last_retire);
+        return -1;
+    }
+
+    if (retired_mispredict) {
+        // Start refilling the dispatch queue now that mispredict is handled
+        cursor->fetch_inst_idx = cursor->retired_inst_idx;
+        cursor->in_mispred = false;
+    }
+
+    if (cursor->icache_miss_ctr != 0) {
+        cursor->icache_miss_ctr--;
+    }
+    if (cursor->icache_miss_ctr == 0 && cursor->in_icache_miss) {
+        cursor->in_icache_miss = false;
+        cursor->finished_miss = true;
+    }
+    return 0;
+}
+
+int trace_cursor_cycle(procsim_stats_t *sim_stats) {
+    return trace_cursor_cycle_with(procsim_do_cycle, sim_stats);
+}
+
+int trace_simulate(const procsim_conf_t *sim_conf, const inst_t *insts,
+                   size_t n_sim_insts, procsim_stats_t *sim_stats,
+                   hotspot_table_t *hotspots) {
+    trace_cursor_t c;
+    trace_cursor_init(&c, insts, n_sim_insts);
+    cursor = &c;
+
+    // Initialize the processor
+    procsim_init(sim_conf, sim_stats);
+    if (hotspots != NULL) {
+        procsim_attach_hotspots(hotspots);
+    }
+
+    while (!trace_cursor_done(&c)) {
+        if (trace_cursor_cycle(sim_stats) != 0) {
+            procsim_finish(sim_stats);
+            return -1;
+        }
+    }
+
+    sim_stats->instructions_in_trace = n_sim_insts;
+
+    // Free memory and generate final statistics
+    procsim_finish(sim_stats);
+    return 0;
+}
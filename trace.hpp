@@ -0,0 +1,92 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#include "procsim.hpp"
+
+// Trace loading and the fetch side of the driver, shared by the procsim
+// executable and libprocsim.
+
+// Binary traces hold the same fields as text traces, but load without any
+// parsing. They start with a header followed by n_insts records, all in host
+// (little-endian) byte order. tools/tracegen writes them.
+#define TRACE_BINARY_MAGIC "PSIMTRC\0"
+#define TRACE_BINARY_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t n_insts;
+} trace_binary_header_t;
+
+#define TRACE_RECORD_MISPREDICT 0x1
+#define TRACE_RECORD_ICACHE_MISS 0x2
+#define TRACE_RECORD_DCACHE_MISS 0x4
+
+typedef struct {
+    uint64_t pc;
+    uint64_t load_store_addr;
+    uint64_t dyn_instruction_count;
+    uint8_t opcode;
+    int8_t dest;  // 0 or -1 for none, as in text traces
+    int8_t src1;
+    int8_t src2;
+    uint8_t flags;  // TRACE_RECORD_* bits
+    uint8_t pad[3];
+} trace_record_t;
+
+/* Read every instruction in a text or binary trace, clearing the miss bits
+ * when sim_conf disables misses. Returns NULL on error */
+inst_t *trace_read(FILE *trace, size_t *size_insts_out, const procsim_conf_t *sim_conf);
+
+/* Fill in the fetch_run of each instruction, after its miss and mispredict
+ * bits have been set */
+void trace_index_fetch_events(inst_t *insts, size_t size_insts);
+
+/* Replace the mispredict bits with the verdicts of sim_conf's branch
+ * predictor, counting branches in sim_stats.
+ * Returns 0 on success, -1 on allocation failure */
+int trace_apply_branch_predictor(inst_t *insts, size_t size_insts,
+                                 const procsim_conf_t *sim_conf,
+                                 procsim_stats_t *sim_stats);
+
+// Fetch state of one trace being simulated. procsim_driver_read_inst() fetches
+// through the calling thread's current cursor, so cores can be simulated on
+// several threads at once
+typedef struct {
+    const inst_t *insts;
+    // Number of trace instructions being simulated, for runs over a prefix
+    size_t n_sim_insts;
+    uint64_t fetch_inst_idx;
+    uint64_t retired_inst_idx;
+    uint64_t cycles_since_last_retire;
+    size_t icache_miss_ctr;
+    bool in_mispred;
+    bool in_icache_miss;
+    bool finished_miss;
+} trace_cursor_t;
+
+/* point a cursor at the first n_sim_insts instructions of a trace */
+void trace_cursor_init(trace_cursor_t *cursor, const inst_t *insts, size_t n_sim_insts);
+/* make cursor the calling thread's current cursor */
+void trace_cursor_select(trace_cursor_t *cursor);
+bool trace_cursor_done(const trace_cursor_t *cursor);
+/* Simulate one cycle of the current core, fetching through the current
+ * cursor. Returns 0 on success and -1 on a deadlock */
+int trace_cursor_cycle(procsim_stats_t *sim_stats);
+// A procsim_do_cycle() to simulate cycles with instead, such as the
+// reference model's
+typedef uint64_t (*trace_cycle_fn_t)(procsim_stats_t *sim_stats, bool *retired_mispredict_out);
+int trace_cursor_cycle_with(trace_cycle_fn_t do_cycle, procsim_stats_t *sim_stats);
+
+/* Simulate the first n_sim_insts instructions of a trace from start to
+ * finish on a new core, filling in *sim_stats, which must be zeroed by the
+ * caller, and adding to the hotspot profile unless it is NULL.
+ * Returns 0 on success and -1 on a deadlock */
+int trace_simulate(const procsim_conf_t *sim_conf, const inst_t *insts,
+                   size_t n_sim_insts, procsim_stats_t *sim_stats,
+                   hotspot_table_t *hotspots);
+
+#endif
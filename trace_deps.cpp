@@ -0,0 +1,149 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "hash.hpp"
+#include "trace_deps.hpp"
+
+#define DEPS_MAGIC "PSIMDEPS"
+#define DEPS_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t n_insts;
+    uint64_t trace_hash;
+} deps_header_t;
+
+inst_deps_t *trace_deps_compute(const inst_t *insts, size_t n_insts) {
+    inst_deps_t *deps = (inst_deps_t *)malloc(n_insts * sizeof(inst_deps_t));
+    if (deps == NULL) return NULL;
+
+    // Forward pass: the last writer of each architectural register
+    int64_t last_writer[NUM_REGS];
+    for (int i = 0; i < NUM_REGS; i++) {
+        last_writer[i] = DEPS_NONE;
+    }
+    for (size_t i = 0; i < n_insts; i++) {
+        const inst_t *inst = &insts[i];
+        deps[i].src1_producer = inst->src1 >= 0 ? last_writer[inst->src1] : DEPS_NONE;
+        deps[i].src2_producer = inst->src2 >= 0 ? last_writer[inst->src2] : DEPS_NONE;
+        if (inst->dest >= 0) {
+            last_writer[inst->dest] = i;
+        }
+    }
+
+    // Backward pass: the next store to each address
+    std::unordered_map<uint64_t, int64_t> next_store;
+    for (size_t i = n_insts; i-- > 0; ) {
+        const inst_t *inst = &insts[i];
+        deps[i].next_store = DEPS_NONE;
+        if (inst->opcode != OPCODE_LOAD && inst->opcode != OPCODE_STORE) {
+            continue;
+        }
+        auto it = next_store.find(inst->load_store_addr);
+        if (it != next_store.end()) {
+            deps[i].next_store = it->second;
+        }
+        if (inst->opcode == OPCODE_STORE) {
+            next_store[inst->load_store_addr] = i;
+        }
+    }
+    return deps;
+}
+
+int trace_deps_hash_file(FILE *trace, uint64_t *hash_out) {
+    long pos = ftell(trace);
+    if (pos < 0 || fseek(trace, 0, SEEK_SET) != 0) {
+        perror("fseek");
+        return -1;
+    }
+    uint64_t hash = FNV1A64_INIT;
+    char buf[1 << 16];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof buf, trace)) > 0) {
+        hash = fnv1a64(buf, len, hash);
+    }
+    if (ferror(trace)) {
+        perror("fread");
+        return -1;
+    }
+    clearerr(trace);
+    if (fseek(trace, pos, SEEK_SET) != 0) {
+        perror("fseek");
+        return -1;
+    }
+    *hash_out = hash;
+    return 0;
+}
+
+/* Returns the annotations from the sidecar at path, or NULL if it is missing,
+ * unreadable or does not belong to this trace */
+static inst_deps_t *trace_deps_load(const char *path, uint64_t trace_hash, size_t n_insts) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    deps_header_t header;
+    inst_deps_t *deps = NULL;
+    if (fread(&header, sizeof header, 1, f) != 1 ||
+            memcmp(header.magic, DEPS_MAGIC, sizeof header.magic) != 0 ||
+            header.version != DEPS_VERSION ||
+            header.entry_size != sizeof(inst_deps_t) ||
+            header.n_insts != n_insts ||
+            header.trace_hash != trace_hash) {
+        fclose(f);
+        return NULL;
+    }
+    deps = (inst_deps_t *)malloc(n_insts * sizeof(inst_deps_t));
+    if (deps != NULL && fread(deps, sizeof(inst_deps_t), n_insts, f) != n_insts) {
+        free(deps);
+        deps = NULL;
+    }
+    fclose(f);
+    return deps;
+}
+
+inst_deps_t *trace_deps_load_or_build(const char *path, uint64_t trace_hash,
+                                      const inst_t *insts, size_t n_insts,
+                                      bool *built_out) {
+    inst_deps_t *deps = trace_deps_load(path, trace_hash, n_insts);
+    if (deps != NULL) {
+        *built_out = false;
+        return deps;
+    }
+
+    deps = trace_deps_compute(insts, n_insts);
+    if (deps == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    *built_out = true;
+
+    // Failing to write the sidecar only costs us the recomputation next time
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror("fopen");
+        return deps;
+    }
+    deps_header_t header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, DEPS_MAGIC, sizeof header.magic);
+    header.version = DEPS_VERSION;
+    header.entry_size = sizeof(inst_deps_t);
+    header.n_insts = n_insts;
+    header.trace_hash = trace_hash;
+    if (fwrite(&header, sizeof header, 1, f) != 1 ||
+            fwrite(deps, sizeof(inst_deps_t), n_insts, f) != n_insts) {
+        perror("fwrite");
+        fclose(f);
+        remove(path);
+        return deps;
+    }
+    if (fclose(f) != 0) {
+        perror("fclose");
+        remove(path);
+    }
+    return deps;
+}
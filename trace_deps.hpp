@@ -0,0 +1,38 @@
+#ifndef TRACE_DEPS_H
+#define TRACE_DEPS_H
+
+#include <stdio.h>
+
+#include "procsim.hpp"
+
+// Dependence annotations for a trace, computed once and stored in a sidecar
+// file next to it (<trace>.deps) so that repeated runs over the same trace
+// don't have to rediscover producers and consumers.
+
+#define DEPS_NONE (-1)
+
+typedef struct {
+    // Trace index of the instruction producing src1/src2, or DEPS_NONE when
+    // the operand is unused or was produced before the start of the trace
+    int64_t src1_producer;
+    int64_t src2_producer;
+    // For loads and stores, the trace index of the next store to the same
+    // address, or DEPS_NONE when there is none
+    int64_t next_store;
+} inst_deps_t;
+
+/* Compute the annotations for a whole trace. Returns NULL on allocation failure */
+inst_deps_t *trace_deps_compute(const inst_t *insts, size_t n_insts);
+
+/* 64-bit hash of a trace file's contents, used to detect stale sidecars. The
+ * file position is restored afterwards. Returns 0 on success, -1 on error */
+int trace_deps_hash_file(FILE *trace, uint64_t *hash_out);
+
+/* Load the sidecar at path if it matches the trace, otherwise compute the
+ * annotations and (re)write the sidecar. *built_out is set to true when the
+ * sidecar had to be rebuilt. Returns NULL on error */
+inst_deps_t *trace_deps_load_or_build(const char *path, uint64_t trace_hash,
+                                      const inst_t *insts, size_t n_insts,
+                                      bool *built_out);
+
+#endif